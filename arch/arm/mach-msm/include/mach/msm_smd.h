@@ -67,6 +67,10 @@ enum {
 
 };
 
+/* Local stream and packet channels on the SMD_LOOPBACK_TYPE edge */
+#define SMD_LOOPBACK_NAME "local_loopback"
+#define SMD_LOOPBACK_PKT_NAME "local_loopback_pkt"
+
 
 struct smd_irq_config {
 	
@@ -130,6 +134,9 @@ int smd_write_user_buffer(smd_channel_t *ch, const void *data, int len);
 int smd_write_avail(smd_channel_t *ch);
 int smd_read_avail(smd_channel_t *ch);
 
+/* Size of the receive fifo, no packet bigger than this fits in it whole */
+int smd_total_fifo_size(smd_channel_t *ch);
+
 int smd_cur_packet_size(smd_channel_t *ch);
 
 
@@ -247,6 +254,11 @@ static inline int smd_read_avail(smd_channel_t *ch)
 	return -ENODEV;
 }
 
+static inline int smd_total_fifo_size(smd_channel_t *ch)
+{
+	return -ENODEV;
+}
+
 static inline int smd_cur_packet_size(smd_channel_t *ch)
 {
 	return -ENODEV;
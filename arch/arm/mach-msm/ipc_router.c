@@ -27,6 +27,9 @@
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/hash.h>
+#include <linux/rculist.h>
+#include <linux/srcu.h>
 
 #include <asm/uaccess.h>
 #include <asm/byteorder.h>
@@ -92,11 +95,21 @@ if (msm_ipc_router_debug_mask & R2R_RAW_HDR) \
 static LIST_HEAD(control_ports);
 static DEFINE_MUTEX(control_ports_lock);
 
+/*
+ * The local port, server and routing tables below are hashed lists.
+ * Writers serialize on the mutexes, readers on the packet paths only
+ * walk them under RCU so that routing a packet takes no global lock.
+ * Local ports are looked up under SRCU instead, since delivering to a
+ * port sleeps on its rx queue lock; closing a port waits for those
+ * readers before the port is freed.
+ */
 #define LP_HASH_SIZE 32
 static struct list_head local_ports[LP_HASH_SIZE];
 static DEFINE_MUTEX(local_ports_lock);
+static struct srcu_struct local_ports_srcu;
 
-#define SRV_HASH_SIZE 32
+#define SRV_HASH_BITS 5
+#define SRV_HASH_SIZE (1 << SRV_HASH_BITS)
 static struct list_head server_list[SRV_HASH_SIZE];
 static DEFINE_MUTEX(server_list_lock);
 static wait_queue_head_t newserver_wait;
@@ -105,12 +118,14 @@ struct msm_ipc_server {
 	struct list_head list;
 	struct msm_ipc_port_name name;
 	struct list_head server_port_list;
+	struct rcu_head rcu;
 };
 
 struct msm_ipc_server_port {
 	struct list_head list;
 	struct msm_ipc_port_addr server_addr;
 	struct msm_ipc_router_xprt_info *xprt_info;
+	struct rcu_head rcu;
 };
 
 #define RP_HASH_SIZE 32
@@ -122,6 +137,7 @@ struct msm_ipc_router_remote_port {
 	wait_queue_head_t quota_wait;
 	uint32_t tx_quota_cnt;
 	struct mutex quota_lock;
+	struct rcu_head rcu;
 };
 
 struct msm_ipc_router_xprt_info {
@@ -138,8 +154,25 @@ struct msm_ipc_router_xprt_info {
 	uint32_t abort_data_read;
 	struct work_struct read_data;
 	struct workqueue_struct *workqueue;
+	struct sk_buff_head skb_pool;
+	unsigned long pool_hits;
+	unsigned long pool_misses;
+	unsigned long pool_recycled;
 };
 
+/*
+ * Control messages to a transport are built in skbs taken from a small
+ * per-transport pool.  Transports are done with a packet when their
+ * write returns, so the skb goes back to the pool right after the
+ * write, all under the transport's tx_lock.
+ */
+#define IPC_ROUTER_CTL_PKT_SIZE \
+	(IPC_ROUTER_HDR_SIZE + sizeof(union rr_control_msg))
+#define IPC_ROUTER_SKB_POOL_SIZE 8
+
+static atomic_t hdr_in_place = ATOMIC_INIT(0);
+static atomic_t hdr_fragments = ATOMIC_INIT(0);
+
 #define RT_HASH_SIZE 4
 struct msm_ipc_routing_table_entry {
 	struct list_head list;
@@ -234,17 +267,22 @@ static int add_routing_table_entry(
 		return -EINVAL;
 
 	key = (rt_entry->node_id % RT_HASH_SIZE);
-	list_add_tail(&rt_entry->list, &routing_table[key]);
+	list_add_tail_rcu(&rt_entry->list, &routing_table[key]);
 	return 0;
 }
 
+/*
+ * Called with either routing_table_lock or rcu_read_lock() held.  Entries
+ * are never removed from the table, so the returned entry stays valid
+ * after either is dropped.
+ */
 static struct msm_ipc_routing_table_entry *lookup_routing_table(
 	uint32_t node_id)
 {
 	uint32_t key = (node_id % RT_HASH_SIZE);
 	struct msm_ipc_routing_table_entry *rt_entry;
 
-	list_for_each_entry(rt_entry, &routing_table[key], list) {
+	list_for_each_entry_rcu(rt_entry, &routing_table[key], list) {
 		if (rt_entry->node_id == node_id)
 			return rt_entry;
 	}
@@ -359,6 +397,114 @@ void release_pkt(struct rr_packet *pkt)
 	return;
 }
 
+/*
+ * Moves the fragments of a packet handed in by a transport to a new
+ * packet instead of cloning each of them.  The transport still releases
+ * its packet, which is left empty.
+ */
+static struct rr_packet *take_pkt(struct rr_packet *pkt)
+{
+	struct rr_packet *new_pkt;
+
+	new_pkt = kzalloc(sizeof(struct rr_packet), GFP_KERNEL);
+	if (!new_pkt) {
+		pr_err("%s: failure\n", __func__);
+		return NULL;
+	}
+
+	new_pkt->pkt_fragment_q = kmalloc(sizeof(struct sk_buff_head),
+					  GFP_KERNEL);
+	if (!new_pkt->pkt_fragment_q) {
+		pr_err("%s: pkt_frag_q alloc failure\n", __func__);
+		kfree(new_pkt);
+		return NULL;
+	}
+	skb_queue_head_init(new_pkt->pkt_fragment_q);
+
+	skb_queue_splice_init(pkt->pkt_fragment_q, new_pkt->pkt_fragment_q);
+	new_pkt->length = pkt->length;
+	pkt->length = 0;
+	return new_pkt;
+}
+
+/*
+ * Prepends the router header to @pkt.  Senders leave headroom for it in
+ * the first fragment so that it is normally written in place, otherwise
+ * it is put in a fragment of its own.
+ */
+static struct rr_header *push_hdr(struct rr_packet *pkt)
+{
+	struct sk_buff *head_skb = skb_peek(pkt->pkt_fragment_q);
+	struct rr_header *hdr;
+
+	if (head_skb && skb_headroom(head_skb) >= IPC_ROUTER_HDR_SIZE &&
+	    !skb_cloned(head_skb)) {
+		hdr = (struct rr_header *)skb_push(head_skb,
+						   IPC_ROUTER_HDR_SIZE);
+		atomic_inc(&hdr_in_place);
+	} else {
+		head_skb = alloc_skb(IPC_ROUTER_HDR_SIZE, GFP_KERNEL);
+		if (!head_skb)
+			return NULL;
+		hdr = (struct rr_header *)skb_put(head_skb,
+						  IPC_ROUTER_HDR_SIZE);
+		skb_queue_head(pkt->pkt_fragment_q, head_skb);
+		atomic_inc(&hdr_fragments);
+	}
+
+	pkt->length += IPC_ROUTER_HDR_SIZE;
+	return hdr;
+}
+
+/* Builds a control message for @dst_node_id in the empty @skb */
+static void put_ctl_msg(struct sk_buff *skb, union rr_control_msg *msg,
+			uint32_t dst_node_id)
+{
+	struct rr_header *hdr;
+
+	hdr = (struct rr_header *)skb_put(skb, IPC_ROUTER_CTL_PKT_SIZE);
+	hdr->version = IPC_ROUTER_VERSION;
+	hdr->type = msg->cmd;
+	hdr->src_node_id = IPC_ROUTER_NID_LOCAL;
+	hdr->src_port_id = IPC_ROUTER_ADDRESS;
+	hdr->confirm_rx = 0;
+	hdr->size = sizeof(*msg);
+	hdr->dst_node_id = dst_node_id;
+	hdr->dst_port_id = IPC_ROUTER_ADDRESS;
+	memcpy(hdr + 1, msg, sizeof(*msg));
+}
+
+/* Called with xprt_info->tx_lock held */
+static struct sk_buff *get_ctl_skb(struct msm_ipc_router_xprt_info *xprt_info)
+{
+	struct sk_buff *skb;
+
+	skb = __skb_dequeue(&xprt_info->skb_pool);
+	if (skb) {
+		xprt_info->pool_hits++;
+		return skb;
+	}
+
+	xprt_info->pool_misses++;
+	skb = alloc_skb(IPC_ROUTER_CTL_PKT_SIZE + NET_SKB_PAD, GFP_KERNEL);
+	if (skb)
+		skb_reserve(skb, NET_SKB_PAD);
+	return skb;
+}
+
+/* Called with xprt_info->tx_lock held */
+static void put_ctl_skb(struct msm_ipc_router_xprt_info *xprt_info,
+			struct sk_buff *skb)
+{
+	if (skb_queue_len(&xprt_info->skb_pool) < IPC_ROUTER_SKB_POOL_SIZE &&
+	    skb_recycle_check(skb, IPC_ROUTER_CTL_PKT_SIZE)) {
+		__skb_queue_tail(&xprt_info->skb_pool, skb);
+		xprt_info->pool_recycled++;
+		return;
+	}
+	kfree_skb(skb);
+}
+
 static int post_control_ports(struct rr_packet *pkt)
 {
 	struct msm_ipc_port *port_ptr;
@@ -425,7 +571,7 @@ void msm_ipc_router_add_local_port(struct msm_ipc_port *port_ptr)
 
 	key = (port_ptr->this_port.port_id & (LP_HASH_SIZE - 1));
 	mutex_lock(&local_ports_lock);
-	list_add_tail(&port_ptr->list, &local_ports[key]);
+	list_add_tail_rcu(&port_ptr->list, &local_ports[key]);
 	mutex_unlock(&local_ports_lock);
 }
 
@@ -469,12 +615,13 @@ struct msm_ipc_port *msm_ipc_router_create_raw_port(void *endpoint,
 	return port_ptr;
 }
 
+/* Called with local_ports_lock or the local_ports_srcu read lock held */
 static struct msm_ipc_port *msm_ipc_router_lookup_local_port(uint32_t port_id)
 {
 	int key = (port_id & (LP_HASH_SIZE - 1));
 	struct msm_ipc_port *port_ptr;
 
-	list_for_each_entry(port_ptr, &local_ports[key], list) {
+	list_for_each_entry_rcu(port_ptr, &local_ports[key], list) {
 		if (port_ptr->this_port.port_id == port_id) {
 			return port_ptr;
 		}
@@ -490,27 +637,24 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_lookup_remote_port(
 	struct msm_ipc_routing_table_entry *rt_entry;
 	int key = (port_id & (RP_HASH_SIZE - 1));
 
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(node_id);
 	if (!rt_entry) {
-		mutex_unlock(&routing_table_lock);
+		rcu_read_unlock();
 		pr_err("%s: Node is not up\n", __func__);
 		return NULL;
 	}
 
-	mutex_lock(&rt_entry->lock);
-	list_for_each_entry(rport_ptr,
-			    &rt_entry->remote_port_list[key], list) {
+	list_for_each_entry_rcu(rport_ptr,
+				&rt_entry->remote_port_list[key], list) {
 		if (rport_ptr->port_id == port_id) {
 			if (rport_ptr->restart_state != RESTART_NORMAL)
 				rport_ptr = NULL;
-			mutex_unlock(&rt_entry->lock);
-			mutex_unlock(&routing_table_lock);
+			rcu_read_unlock();
 			return rport_ptr;
 		}
 	}
-	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -545,8 +689,8 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_create_remote_port(
 	rport_ptr->tx_quota_cnt = 0;
 	init_waitqueue_head(&rport_ptr->quota_wait);
 	mutex_init(&rport_ptr->quota_lock);
-	list_add_tail(&rport_ptr->list,
-		      &rt_entry->remote_port_list[key]);
+	list_add_tail_rcu(&rport_ptr->list,
+			  &rt_entry->remote_port_list[key]);
 	mutex_unlock(&rt_entry->lock);
 	mutex_unlock(&routing_table_lock);
 	return rport_ptr;
@@ -571,14 +715,20 @@ static void msm_ipc_router_destroy_remote_port(
 	}
 
 	mutex_lock(&rt_entry->lock);
-	list_del(&rport_ptr->list);
-	kfree(rport_ptr);
+	list_del_rcu(&rport_ptr->list);
+	kfree_rcu(rport_ptr, rcu);
 	mutex_unlock(&rt_entry->lock);
 	mutex_unlock(&routing_table_lock);
 	return;
 }
 
-static struct msm_ipc_server *msm_ipc_router_lookup_server(
+static inline int server_hash(uint32_t service, uint32_t instance)
+{
+	return hash_32(service ^ instance, SRV_HASH_BITS);
+}
+
+/* Called with either server_list_lock or rcu_read_lock() held */
+static struct msm_ipc_server *__msm_ipc_router_lookup_server(
 				uint32_t service,
 				uint32_t instance,
 				uint32_t node_id,
@@ -586,30 +736,39 @@ static struct msm_ipc_server *msm_ipc_router_lookup_server(
 {
 	struct msm_ipc_server *server;
 	struct msm_ipc_server_port *server_port;
-	int key = (instance & (SRV_HASH_SIZE - 1));
+	int key = server_hash(service, instance);
 
-	mutex_lock(&server_list_lock);
-	list_for_each_entry(server, &server_list[key], list) {
+	list_for_each_entry_rcu(server, &server_list[key], list) {
 		if ((server->name.service != service) ||
 		    (server->name.instance != instance))
 			continue;
-		if ((node_id == 0) && (port_id == 0)) {
-			mutex_unlock(&server_list_lock);
+		if ((node_id == 0) && (port_id == 0))
 			return server;
-		}
-		list_for_each_entry(server_port, &server->server_port_list,
-				    list) {
+		list_for_each_entry_rcu(server_port,
+					&server->server_port_list, list) {
 			if ((server_port->server_addr.node_id == node_id) &&
-			    (server_port->server_addr.port_id == port_id)) {
-				mutex_unlock(&server_list_lock);
+			    (server_port->server_addr.port_id == port_id))
 				return server;
-			}
 		}
 	}
-	mutex_unlock(&server_list_lock);
 	return NULL;
 }
 
+static struct msm_ipc_server *msm_ipc_router_lookup_server(
+				uint32_t service,
+				uint32_t instance,
+				uint32_t node_id,
+				uint32_t port_id)
+{
+	struct msm_ipc_server *server;
+
+	rcu_read_lock();
+	server = __msm_ipc_router_lookup_server(service, instance,
+						node_id, port_id);
+	rcu_read_unlock();
+	return server;
+}
+
 static struct msm_ipc_server *msm_ipc_router_create_server(
 					uint32_t service,
 					uint32_t instance,
@@ -619,7 +778,7 @@ static struct msm_ipc_server *msm_ipc_router_create_server(
 {
 	struct msm_ipc_server *server = NULL;
 	struct msm_ipc_server_port *server_port;
-	int key = (instance & (SRV_HASH_SIZE - 1));
+	int key = server_hash(service, instance);
 
 	mutex_lock(&server_list_lock);
 	list_for_each_entry(server, &server_list[key], list) {
@@ -637,14 +796,14 @@ static struct msm_ipc_server *msm_ipc_router_create_server(
 	server->name.service = service;
 	server->name.instance = instance;
 	INIT_LIST_HEAD(&server->server_port_list);
-	list_add_tail(&server->list, &server_list[key]);
+	list_add_tail_rcu(&server->list, &server_list[key]);
 
 create_srv_port:
 	server_port = kmalloc(sizeof(struct msm_ipc_server_port), GFP_KERNEL);
 	if (!server_port) {
 		if (list_empty(&server->server_port_list)) {
-			list_del(&server->list);
-			kfree(server);
+			list_del_rcu(&server->list);
+			kfree_rcu(server, rcu);
 		}
 		mutex_unlock(&server_list_lock);
 		pr_err("%s: Server Port allocation failed\n", __func__);
@@ -653,7 +812,7 @@ create_srv_port:
 	server_port->server_addr.node_id = node_id;
 	server_port->server_addr.port_id = port_id;
 	server_port->xprt_info = xprt_info;
-	list_add_tail(&server_port->list, &server->server_port_list);
+	list_add_tail_rcu(&server_port->list, &server->server_port_list);
 	mutex_unlock(&server_list_lock);
 
 	return server;
@@ -670,16 +829,15 @@ static void msm_ipc_router_destroy_server(struct msm_ipc_server *server,
 	mutex_lock(&server_list_lock);
 	list_for_each_entry(server_port, &server->server_port_list, list) {
 		if ((server_port->server_addr.node_id == node_id) &&
-		    (server_port->server_addr.port_id == port_id))
+		    (server_port->server_addr.port_id == port_id)) {
+			list_del_rcu(&server_port->list);
+			kfree_rcu(server_port, rcu);
 			break;
-	}
-	if (server_port) {
-		list_del(&server_port->list);
-		kfree(server_port);
+		}
 	}
 	if (list_empty(&server->server_port_list)) {
-		list_del(&server->list);
-		kfree(server);
+		list_del_rcu(&server->list);
+		kfree_rcu(server, rcu);
 	}
 	mutex_unlock(&server_list_lock);
 	return;
@@ -689,12 +847,9 @@ static int msm_ipc_router_send_control_msg(
 		struct msm_ipc_router_xprt_info *xprt_info,
 		union rr_control_msg *msg)
 {
-	struct rr_packet *pkt;
+	struct rr_packet pkt;
+	struct sk_buff_head pkt_fragment_q;
 	struct sk_buff *ipc_rtr_pkt;
-	struct rr_header *hdr;
-	int pkt_size;
-	void *data;
-	struct sk_buff_head *pkt_fragment_q;
 	int ret;
 
 	if (!xprt_info || ((msg->cmd != IPC_ROUTER_CTRL_CMD_HELLO) &&
@@ -706,58 +861,25 @@ static int msm_ipc_router_send_control_msg(
 	if (xprt_info->remote_node_id == IPC_ROUTER_NID_LOCAL)
 		return 0;
 
-	pkt = kzalloc(sizeof(struct rr_packet), GFP_KERNEL);
-	if (!pkt) {
-		pr_err("%s: pkt alloc failed\n", __func__);
-		return -ENOMEM;
-	}
-
-	pkt_fragment_q = kmalloc(sizeof(struct sk_buff_head), GFP_KERNEL);
-	if (!pkt_fragment_q) {
-		pr_err("%s: pkt_fragment_q alloc failed\n", __func__);
-		kfree(pkt);
-		return -ENOMEM;
-	}
-	skb_queue_head_init(pkt_fragment_q);
-
-	pkt_size = IPC_ROUTER_HDR_SIZE + sizeof(*msg);
-	ipc_rtr_pkt = alloc_skb(pkt_size, GFP_KERNEL);
+	mutex_lock(&xprt_info->tx_lock);
+	ipc_rtr_pkt = get_ctl_skb(xprt_info);
 	if (!ipc_rtr_pkt) {
+		mutex_unlock(&xprt_info->tx_lock);
 		pr_err("%s: ipc_rtr_pkt alloc failed\n", __func__);
-		kfree(pkt_fragment_q);
-		kfree(pkt);
 		return -ENOMEM;
 	}
+	put_ctl_msg(ipc_rtr_pkt, msg, xprt_info->remote_node_id);
 
-	skb_reserve(ipc_rtr_pkt, IPC_ROUTER_HDR_SIZE);
-	data = skb_put(ipc_rtr_pkt, sizeof(*msg));
-	memcpy(data, msg, sizeof(*msg));
-	hdr = (struct rr_header *)skb_push(ipc_rtr_pkt, IPC_ROUTER_HDR_SIZE);
-	if (!hdr) {
-		pr_err("%s: skb_push failed\n", __func__);
-		kfree_skb(ipc_rtr_pkt);
-		kfree(pkt_fragment_q);
-		kfree(pkt);
-		return -ENOMEM;
-	}
+	skb_queue_head_init(&pkt_fragment_q);
+	__skb_queue_tail(&pkt_fragment_q, ipc_rtr_pkt);
+	pkt.pkt_fragment_q = &pkt_fragment_q;
+	pkt.length = IPC_ROUTER_CTL_PKT_SIZE;
 
-	hdr->version = IPC_ROUTER_VERSION;
-	hdr->type = msg->cmd;
-	hdr->src_node_id = IPC_ROUTER_NID_LOCAL;
-	hdr->src_port_id = IPC_ROUTER_ADDRESS;
-	hdr->confirm_rx = 0;
-	hdr->size = sizeof(*msg);
-	hdr->dst_node_id = xprt_info->remote_node_id;
-	hdr->dst_port_id = IPC_ROUTER_ADDRESS;
-	skb_queue_tail(pkt_fragment_q, ipc_rtr_pkt);
-	pkt->pkt_fragment_q = pkt_fragment_q;
-	pkt->length = pkt_size;
+	ret = xprt_info->xprt->write(&pkt, pkt.length, xprt_info->xprt);
 
-	mutex_lock(&xprt_info->tx_lock);
-	ret = xprt_info->xprt->write(pkt, pkt_size, xprt_info->xprt);
+	__skb_unlink(ipc_rtr_pkt, &pkt_fragment_q);
+	put_ctl_skb(xprt_info, ipc_rtr_pkt);
 	mutex_unlock(&xprt_info->tx_lock);
-
-	release_pkt(pkt);
 	return ret;
 }
 
@@ -829,62 +951,26 @@ static char *type_to_str(int i)
 
 static int broadcast_ctl_msg_locally(union rr_control_msg *msg)
 {
-	struct rr_packet *pkt;
+	struct rr_packet pkt;
+	struct sk_buff_head pkt_fragment_q;
 	struct sk_buff *ipc_rtr_pkt;
-	struct rr_header *hdr;
-	int pkt_size;
-	void *data;
-	struct sk_buff_head *pkt_fragment_q;
 	int ret;
 
-	pkt = kzalloc(sizeof(struct rr_packet), GFP_KERNEL);
-	if (!pkt) {
-		pr_err("%s: pkt alloc failed\n", __func__);
-		return -ENOMEM;
-	}
-
-	pkt_fragment_q = kmalloc(sizeof(struct sk_buff_head), GFP_KERNEL);
-	if (!pkt_fragment_q) {
-		pr_err("%s: pkt_fragment_q alloc failed\n", __func__);
-		kfree(pkt);
-		return -ENOMEM;
-	}
-	skb_queue_head_init(pkt_fragment_q);
-
-	pkt_size = IPC_ROUTER_HDR_SIZE + sizeof(*msg);
-	ipc_rtr_pkt = alloc_skb(pkt_size, GFP_KERNEL);
+	ipc_rtr_pkt = alloc_skb(IPC_ROUTER_CTL_PKT_SIZE, GFP_KERNEL);
 	if (!ipc_rtr_pkt) {
 		pr_err("%s: ipc_rtr_pkt alloc failed\n", __func__);
-		kfree(pkt_fragment_q);
-		kfree(pkt);
 		return -ENOMEM;
 	}
+	put_ctl_msg(ipc_rtr_pkt, msg, IPC_ROUTER_NID_LOCAL);
 
-	skb_reserve(ipc_rtr_pkt, IPC_ROUTER_HDR_SIZE);
-	data = skb_put(ipc_rtr_pkt, sizeof(*msg));
-	memcpy(data, msg, sizeof(*msg));
-	hdr = (struct rr_header *)skb_push(ipc_rtr_pkt, IPC_ROUTER_HDR_SIZE);
-	if (!hdr) {
-		pr_err("%s: skb_push failed\n", __func__);
-		kfree_skb(ipc_rtr_pkt);
-		kfree(pkt_fragment_q);
-		kfree(pkt);
-		return -ENOMEM;
-	}
-	hdr->version = IPC_ROUTER_VERSION;
-	hdr->type = msg->cmd;
-	hdr->src_node_id = IPC_ROUTER_NID_LOCAL;
-	hdr->src_port_id = IPC_ROUTER_ADDRESS;
-	hdr->confirm_rx = 0;
-	hdr->size = sizeof(*msg);
-	hdr->dst_node_id = IPC_ROUTER_NID_LOCAL;
-	hdr->dst_port_id = IPC_ROUTER_ADDRESS;
-	skb_queue_tail(pkt_fragment_q, ipc_rtr_pkt);
-	pkt->pkt_fragment_q = pkt_fragment_q;
-	pkt->length = pkt_size;
+	/* The control ports get clones, this packet is only ours */
+	skb_queue_head_init(&pkt_fragment_q);
+	__skb_queue_tail(&pkt_fragment_q, ipc_rtr_pkt);
+	pkt.pkt_fragment_q = &pkt_fragment_q;
+	pkt.length = IPC_ROUTER_CTL_PKT_SIZE;
 
-	ret = post_control_ports(pkt);
-	release_pkt(pkt);
+	ret = post_control_ports(&pkt);
+	__skb_queue_purge(&pkt_fragment_q);
 	return ret;
 }
 
@@ -957,21 +1043,26 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 
 	hdr = (struct rr_header *)head_pkt->data;
 	dst_node_id = hdr->dst_node_id;
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(dst_node_id);
-	if (!(rt_entry) || !(rt_entry->xprt_info)) {
-		mutex_unlock(&routing_table_lock);
+	rcu_read_unlock();
+	if (!rt_entry) {
 		pr_err("%s: Routing table not initialized\n", __func__);
 		return -ENODEV;
 	}
 
 	mutex_lock(&rt_entry->lock);
 	fwd_xprt_info = rt_entry->xprt_info;
+	if (!fwd_xprt_info) {
+		mutex_unlock(&rt_entry->lock);
+		pr_err("%s: Routing table not initialized\n", __func__);
+		return -ENODEV;
+	}
+
 	mutex_lock(&fwd_xprt_info->tx_lock);
 	if (xprt_info->remote_node_id == fwd_xprt_info->remote_node_id) {
 		mutex_unlock(&fwd_xprt_info->tx_lock);
 		mutex_unlock(&rt_entry->lock);
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: Discarding Command to route back\n", __func__);
 		return -EINVAL;
 	}
@@ -979,14 +1070,12 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 	if (xprt_info->xprt->link_id == fwd_xprt_info->xprt->link_id) {
 		mutex_unlock(&fwd_xprt_info->tx_lock);
 		mutex_unlock(&rt_entry->lock);
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: DST in the same cluster\n", __func__);
 		return 0;
 	}
 	fwd_xprt_info->xprt->write(pkt, pkt->length, fwd_xprt_info->xprt);
 	mutex_unlock(&fwd_xprt_info->tx_lock);
 	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
 
 	return 0;
 }
@@ -1042,12 +1131,12 @@ static void msm_ipc_cleanup_remote_server_info(
 				ctl.srv.port_id = svr_port->server_addr.port_id;
 				relay_ctl_msg(xprt_info, &ctl);
 				broadcast_ctl_msg_locally(&ctl);
-				list_del(&svr_port->list);
-				kfree(svr_port);
+				list_del_rcu(&svr_port->list);
+				kfree_rcu(svr_port, rcu);
 			}
 			if (list_empty(&svr->server_port_list)) {
-				list_del(&svr->list);
-				kfree(svr);
+				list_del_rcu(&svr->list);
+				kfree_rcu(svr, rcu);
 			}
 		}
 	}
@@ -1116,8 +1205,8 @@ static void msm_ipc_cleanup_remote_port_info(uint32_t node_id)
 				list_for_each_entry_safe(rport_ptr,
 					tmp_rport_ptr,
 					&rt_entry->remote_port_list[j], list) {
-					list_del(&rport_ptr->list);
-					kfree(rport_ptr);
+					list_del_rcu(&rport_ptr->list);
+					kfree_rcu(rport_ptr, rcu);
 				}
 			}
 			mutex_unlock(&rt_entry->lock);
@@ -1352,6 +1441,7 @@ static void do_read_data(struct work_struct *work)
 	struct msm_ipc_port_addr *src_addr;
 	struct msm_ipc_router_remote_port *rport_ptr;
 	uint32_t resume_tx, resume_tx_node_id, resume_tx_port_id;
+	int srcu_idx;
 
 	struct msm_ipc_router_xprt_info *xprt_info =
 		container_of(work,
@@ -1429,12 +1519,12 @@ static void do_read_data(struct work_struct *work)
 	rport_ptr = msm_ipc_router_lookup_remote_port(hdr->src_node_id,
 						      hdr->src_port_id);
 
-	mutex_lock(&local_ports_lock);
+	srcu_idx = srcu_read_lock(&local_ports_srcu);
 	port_ptr = msm_ipc_router_lookup_local_port(hdr->dst_port_id);
 	if (!port_ptr) {
 		pr_err("%s: No local port id %08x\n", __func__,
 			hdr->dst_port_id);
-		mutex_unlock(&local_ports_lock);
+		srcu_read_unlock(&local_ports_srcu, srcu_idx);
 		release_pkt(pkt);
 		goto process_done;
 	}
@@ -1446,7 +1536,7 @@ static void do_read_data(struct work_struct *work)
 		if (!rport_ptr) {
 			pr_err("%s: Remote port %08x:%08x creation failed\n",
 				__func__, hdr->src_node_id, hdr->src_port_id);
-			mutex_unlock(&local_ports_lock);
+			srcu_read_unlock(&local_ports_srcu, srcu_idx);
 			goto process_done;
 		}
 	}
@@ -1457,7 +1547,6 @@ static void do_read_data(struct work_struct *work)
 		list_add_tail(&pkt->list, &port_ptr->port_rx_q);
 		wake_up(&port_ptr->port_rx_wait_q);
 		mutex_unlock(&port_ptr->port_rx_q_lock);
-		mutex_unlock(&local_ports_lock);
 	} else {
 		mutex_lock(&port_ptr->port_rx_q_lock);
 		src_addr = kmalloc(sizeof(struct msm_ipc_port_addr),
@@ -1467,7 +1556,6 @@ static void do_read_data(struct work_struct *work)
 			src_addr->port_id = hdr->src_port_id;
 		}
 		skb_pull(head_skb, IPC_ROUTER_HDR_SIZE);
-		mutex_unlock(&local_ports_lock);
 		port_ptr->notify(MSM_IPC_ROUTER_READ_CB, pkt->pkt_fragment_q,
 				 src_addr, port_ptr->priv);
 		mutex_unlock(&port_ptr->port_rx_q_lock);
@@ -1475,6 +1563,7 @@ static void do_read_data(struct work_struct *work)
 		src_addr = NULL;
 		release_pkt(pkt);
 	}
+	srcu_read_unlock(&local_ports_srcu, srcu_idx);
 
 process_done:
 	if (resume_tx) {
@@ -1593,10 +1682,10 @@ static int loopback_data(struct msm_ipc_port *src,
 			uint32_t port_id,
 			struct sk_buff_head *data)
 {
-	struct sk_buff *head_skb;
 	struct rr_header *hdr;
 	struct msm_ipc_port *port_ptr;
 	struct rr_packet *pkt;
+	int srcu_idx;
 
 	if (!data) {
 		pr_err("%s: Invalid pkt pointer\n", __func__);
@@ -1609,12 +1698,11 @@ static int loopback_data(struct msm_ipc_port *src,
 		return -ENOMEM;
 	}
 
-	head_skb = skb_peek(pkt->pkt_fragment_q);
-	if (!head_skb) {
+	if (skb_queue_empty(pkt->pkt_fragment_q)) {
 		pr_err("%s: pkt_fragment_q is empty\n", __func__);
 		return -EINVAL;
 	}
-	hdr = (struct rr_header *)skb_push(head_skb, IPC_ROUTER_HDR_SIZE);
+	hdr = push_hdr(pkt);
 	if (!hdr) {
 		pr_err("%s: Prepend Header failed\n", __func__);
 		release_pkt(pkt);
@@ -1624,17 +1712,16 @@ static int loopback_data(struct msm_ipc_port *src,
 	hdr->type = IPC_ROUTER_CTRL_CMD_DATA;
 	hdr->src_node_id = src->this_port.node_id;
 	hdr->src_port_id = src->this_port.port_id;
-	hdr->size = pkt->length;
+	hdr->size = pkt->length - IPC_ROUTER_HDR_SIZE;
 	hdr->confirm_rx = 0;
 	hdr->dst_node_id = IPC_ROUTER_NID_LOCAL;
 	hdr->dst_port_id = port_id;
-	pkt->length += IPC_ROUTER_HDR_SIZE;
 
-	mutex_lock(&local_ports_lock);
+	srcu_idx = srcu_read_lock(&local_ports_srcu);
 	port_ptr = msm_ipc_router_lookup_local_port(port_id);
 	if (!port_ptr) {
 		pr_err("%s: Local port %d not present\n", __func__, port_id);
-		mutex_unlock(&local_ports_lock);
+		srcu_read_unlock(&local_ports_srcu, srcu_idx);
 		release_pkt(pkt);
 		return -ENODEV;
 	}
@@ -1644,7 +1731,7 @@ static int loopback_data(struct msm_ipc_port *src,
 	list_add_tail(&pkt->list, &port_ptr->port_rx_q);
 	wake_up(&port_ptr->port_rx_wait_q);
 	mutex_unlock(&port_ptr->port_rx_q_lock);
-	mutex_unlock(&local_ports_lock);
+	srcu_read_unlock(&local_ports_srcu, srcu_idx);
 
 	return pkt->length;
 }
@@ -1653,7 +1740,6 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 				struct msm_ipc_router_remote_port *rport_ptr,
 				struct rr_packet *pkt)
 {
-	struct sk_buff *head_skb;
 	struct rr_header *hdr;
 	struct msm_ipc_router_xprt_info *xprt_info;
 	struct msm_ipc_routing_table_entry *rt_entry;
@@ -1663,12 +1749,11 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 	if (!rport_ptr || !src || !pkt)
 		return -EINVAL;
 
-	head_skb = skb_peek(pkt->pkt_fragment_q);
-	if (!head_skb) {
+	if (skb_queue_empty(pkt->pkt_fragment_q)) {
 		pr_err("%s: pkt_fragment_q is empty\n", __func__);
 		return -EINVAL;
 	}
-	hdr = (struct rr_header *)skb_push(head_skb, IPC_ROUTER_HDR_SIZE);
+	hdr = push_hdr(pkt);
 	if (!hdr) {
 		pr_err("%s: Prepend Header failed\n", __func__);
 		return -ENOMEM;
@@ -1677,11 +1762,10 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 	hdr->type = IPC_ROUTER_CTRL_CMD_DATA;
 	hdr->src_node_id = src->this_port.node_id;
 	hdr->src_port_id = src->this_port.port_id;
-	hdr->size = pkt->length;
+	hdr->size = pkt->length - IPC_ROUTER_HDR_SIZE;
 	hdr->confirm_rx = 0;
 	hdr->dst_node_id = rport_ptr->node_id;
 	hdr->dst_port_id = rport_ptr->port_id;
-	pkt->length += IPC_ROUTER_HDR_SIZE;
 
 	for (;;) {
 		prepare_to_wait(&rport_ptr->quota_wait, &__wait,
@@ -1712,21 +1796,26 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 		hdr->confirm_rx = 1;
 	mutex_unlock(&rport_ptr->quota_lock);
 
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(hdr->dst_node_id);
-	if (!rt_entry || !rt_entry->xprt_info) {
-		mutex_unlock(&routing_table_lock);
+	rcu_read_unlock();
+	if (!rt_entry) {
 		pr_err("%s: Remote node %d not up\n",
 			__func__, hdr->dst_node_id);
 		return -ENODEV;
 	}
 	mutex_lock(&rt_entry->lock);
 	xprt_info = rt_entry->xprt_info;
+	if (!xprt_info) {
+		mutex_unlock(&rt_entry->lock);
+		pr_err("%s: Remote node %d not up\n",
+			__func__, hdr->dst_node_id);
+		return -ENODEV;
+	}
 	mutex_lock(&xprt_info->tx_lock);
 	ret = xprt_info->xprt->write(pkt, pkt->length, xprt_info->xprt);
 	mutex_unlock(&xprt_info->tx_lock);
 	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
 
 	if (ret < 0) {
 		pr_err("%s: Write on XPRT failed\n", __func__);
@@ -1781,21 +1870,26 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 		dst_node_id = dest->addr.port_addr.node_id;
 		dst_port_id = dest->addr.port_addr.port_id;
 	} else if (dest->addrtype == MSM_IPC_ADDR_NAME) {
-		server = msm_ipc_router_lookup_server(
+		ret = -ENODEV;
+		rcu_read_lock();
+		server = __msm_ipc_router_lookup_server(
 					dest->addr.port_name.service,
 					dest->addr.port_name.instance,
 					0, 0);
-		if (!server) {
+		if (server) {
+			list_for_each_entry_rcu(server_port,
+					&server->server_port_list, list) {
+				dst_node_id = server_port->server_addr.node_id;
+				dst_port_id = server_port->server_addr.port_id;
+				ret = 0;
+				break;
+			}
+		}
+		rcu_read_unlock();
+		if (ret) {
 			pr_err("%s: Destination not reachable\n", __func__);
-			return -ENODEV;
+			return ret;
 		}
-		mutex_lock(&server_list_lock);
-		server_port = list_first_entry(&server->server_port_list,
-					       struct msm_ipc_server_port,
-					       list);
-		dst_node_id = server_port->server_addr.node_id;
-		dst_port_id = server_port->server_addr.port_id;
-		mutex_unlock(&server_list_lock);
 	}
 	if (dst_node_id == IPC_ROUTER_NID_LOCAL) {
 		ret = loopback_data(src, dst_port_id, data);
@@ -1938,8 +2032,9 @@ int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 
 	if (port_ptr->type == SERVER_PORT || port_ptr->type == CLIENT_PORT) {
 		mutex_lock(&local_ports_lock);
-		list_del(&port_ptr->list);
+		list_del_rcu(&port_ptr->list);
 		mutex_unlock(&local_ports_lock);
+		synchronize_srcu(&local_ports_srcu);
 
 		if (port_ptr->type == SERVER_PORT) {
 			msg.cmd = IPC_ROUTER_CTRL_CMD_REMOVE_SERVER;
@@ -2014,8 +2109,9 @@ int msm_ipc_router_bind_control_port(struct msm_ipc_port *port_ptr)
 		return -EINVAL;
 
 	mutex_lock(&local_ports_lock);
-	list_del(&port_ptr->list);
+	list_del_rcu(&port_ptr->list);
 	mutex_unlock(&local_ports_lock);
+	synchronize_srcu(&local_ports_srcu);
 	port_ptr->type = CONTROL_PORT;
 	mutex_lock(&control_ports_lock);
 	list_add_tail(&port_ptr->list, &control_ports);
@@ -2044,17 +2140,17 @@ int msm_ipc_router_lookup_server_name(struct msm_ipc_port_name *srv_name,
 		return -EINVAL;
 	}
 
-	mutex_lock(&server_list_lock);
+	rcu_read_lock();
 	if (!lookup_mask)
 		lookup_mask = 0xFFFFFFFF;
 	for (key = 0; key < SRV_HASH_SIZE; key++) {
-		list_for_each_entry(server, &server_list[key], list) {
+		list_for_each_entry_rcu(server, &server_list[key], list) {
 			if ((server->name.service != srv_name->service) ||
 			    ((server->name.instance & lookup_mask) !=
 				srv_name->instance))
 				continue;
 
-			list_for_each_entry(server_port,
+			list_for_each_entry_rcu(server_port,
 				&server->server_port_list, list) {
 				if (i < num_entries_in_array) {
 					srv_addr[i].node_id =
@@ -2066,7 +2162,7 @@ int msm_ipc_router_lookup_server_name(struct msm_ipc_port_name *srv_name,
 			}
 		}
 	}
-	mutex_unlock(&server_list_lock);
+	rcu_read_unlock();
 
 	return i;
 }
@@ -2092,17 +2188,17 @@ int msm_ipc_router_lookup_server_name(struct msm_ipc_port_name *srv_name,
 		return -EINVAL;
 	}
 
-	mutex_lock(&server_list_lock);
+	rcu_read_lock();
 	if (!lookup_mask)
 		lookup_mask = 0xFFFFFFFF;
 	for (key = 0; key < SRV_HASH_SIZE; key++) {
-		list_for_each_entry(server, &server_list[key], list) {
+		list_for_each_entry_rcu(server, &server_list[key], list) {
 			if ((server->name.service != srv_name->service) ||
 			    ((server->name.instance & lookup_mask) !=
 				srv_name->instance))
 				continue;
 
-			list_for_each_entry(server_port,
+			list_for_each_entry_rcu(server_port,
 				&server->server_port_list, list) {
 				if (i < num_entries_in_array) {
 					srv_info[i].node_id =
@@ -2118,7 +2214,7 @@ int msm_ipc_router_lookup_server_name(struct msm_ipc_port_name *srv_name,
 			}
 		}
 	}
-	mutex_unlock(&server_list_lock);
+	rcu_read_unlock();
 
 	return i;
 }
@@ -2133,6 +2229,7 @@ int msm_ipc_router_close(void)
 				 &xprt_info_list, list) {
 		xprt_info->xprt->close(xprt_info->xprt);
 		list_del(&xprt_info->list);
+		skb_queue_purge(&xprt_info->skb_pool);
 		kfree(xprt_info);
 	}
 	mutex_unlock(&xprt_info_list_lock);
@@ -2195,6 +2292,36 @@ static int dump_xprt_info(char *buf, int max)
 	return i;
 }
 
+static int dump_alloc_stats(char *buf, int max)
+{
+	int i = 0;
+	struct msm_ipc_router_xprt_info *xprt_info;
+
+	i += scnprintf(buf + i, max - i, "Headers in place: %d\n",
+		       atomic_read(&hdr_in_place));
+	i += scnprintf(buf + i, max - i, "Header fragments: %d\n",
+		       atomic_read(&hdr_fragments));
+	i += scnprintf(buf + i, max - i, "\n");
+
+	mutex_lock(&xprt_info_list_lock);
+	list_for_each_entry(xprt_info, &xprt_info_list, list) {
+		i += scnprintf(buf + i, max - i, "XPRT Name: %s\n",
+			       xprt_info->xprt->name);
+		i += scnprintf(buf + i, max - i, "Pool skbs: %d\n",
+			       skb_queue_len(&xprt_info->skb_pool));
+		i += scnprintf(buf + i, max - i, "Pool hits: %lu\n",
+			       xprt_info->pool_hits);
+		i += scnprintf(buf + i, max - i, "Pool misses: %lu\n",
+			       xprt_info->pool_misses);
+		i += scnprintf(buf + i, max - i, "Pool recycled: %lu\n",
+			       xprt_info->pool_recycled);
+		i += scnprintf(buf + i, max - i, "\n");
+	}
+	mutex_unlock(&xprt_info_list_lock);
+
+	return i;
+}
+
 static int dump_servers(char *buf, int max)
 {
 	int i = 0, j;
@@ -2358,6 +2485,8 @@ static void debugfs_init(void)
 		      dump_xprt_info);
 	debug_create("dump_routing_table", 0444, dent,
 		      dump_routing_table);
+	debug_create("dump_alloc_stats", 0444, dent,
+		      dump_alloc_stats);
 }
 
 #else
@@ -2368,6 +2497,8 @@ static int msm_ipc_router_add_xprt(struct msm_ipc_router_xprt *xprt)
 {
 	struct msm_ipc_router_xprt_info *xprt_info;
 	struct msm_ipc_routing_table_entry *rt_entry;
+	struct sk_buff *skb;
+	int i;
 
 	xprt_info = kzalloc(sizeof(struct msm_ipc_router_xprt_info),
 			    GFP_KERNEL);
@@ -2388,8 +2519,20 @@ static int msm_ipc_router_add_xprt(struct msm_ipc_router_xprt *xprt)
 	INIT_WORK(&xprt_info->read_data, do_read_data);
 	INIT_LIST_HEAD(&xprt_info->list);
 
+	/* The pool is only a cache, it refills from alloc_skb() on a miss */
+	skb_queue_head_init(&xprt_info->skb_pool);
+	for (i = 0; i < IPC_ROUTER_SKB_POOL_SIZE; i++) {
+		skb = alloc_skb(IPC_ROUTER_CTL_PKT_SIZE + NET_SKB_PAD,
+				GFP_KERNEL);
+		if (!skb)
+			break;
+		skb_reserve(skb, NET_SKB_PAD);
+		__skb_queue_tail(&xprt_info->skb_pool, skb);
+	}
+
 	xprt_info->workqueue = create_singlethread_workqueue(xprt->name);
 	if (!xprt_info->workqueue) {
+		skb_queue_purge(&xprt_info->skb_pool);
 		kfree(xprt_info);
 		return -ENOMEM;
 	}
@@ -2436,6 +2579,7 @@ static void msm_ipc_router_remove_xprt(struct msm_ipc_router_xprt *xprt)
 		flush_workqueue(xprt_info->workqueue);
 		destroy_workqueue(xprt_info->workqueue);
 		wake_lock_destroy(&xprt_info->wakelock);
+		skb_queue_purge(&xprt_info->skb_pool);
 
 		xprt->priv = 0;
 		kfree(xprt_info);
@@ -2518,7 +2662,7 @@ void msm_ipc_router_xprt_notify(struct msm_ipc_router_xprt *xprt,
 		xprt_info = xprt->priv;
 	}
 
-	pkt = clone_pkt((struct rr_packet *)data);
+	pkt = take_pkt((struct rr_packet *)data);
 	if (!pkt)
 		return;
 
@@ -2586,6 +2730,9 @@ static int __init msm_ipc_router_init(void)
 
 	for (i = 0; i < LP_HASH_SIZE; i++)
 		INIT_LIST_HEAD(&local_ports[i]);
+	ret = init_srcu_struct(&local_ports_srcu);
+	if (ret < 0)
+		return ret;
 
 	mutex_lock(&routing_table_lock);
 	if (!routing_table_inited) {
@@ -145,6 +145,12 @@ enum write_data_type {
 	PAYLOAD,
 };
 
+/*
+ * A transport must be done with the packet passed to write() when it
+ * returns.  Packets passed to msm_ipc_router_xprt_notify() have their
+ * fragments taken by the router and are left empty for the transport
+ * to release.
+ */
 struct msm_ipc_router_xprt {
 	char *name;
 	uint32_t link_id;
@@ -34,6 +34,7 @@
 #include <linux/kfifo.h>
 #include <linux/wakelock.h>
 #include <linux/notifier.h>
+#include <linux/hrtimer.h>
 #include <linux/sort.h>
 #include <linux/suspend.h>
 #include <mach/msm_smd.h>
@@ -191,6 +192,32 @@ static int msm_smd_debug_mask;
 module_param_named(debug_mask, msm_smd_debug_mask,
 		   int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * Interrupt coalescing.  A channel getting coalesce_thresh or more data
+ * events within SMD_COALESCE_WINDOW is taken off interrupts and polled
+ * every poll_interval_us instead, so a burst of writes from the remote
+ * side costs one notification instead of one per interrupt.  A poll
+ * notifies at most poll_budget channels, and a channel that has been
+ * idle for poll_idle polls goes back to interrupts.  0 disables it.
+ */
+static int smd_coalesce_thresh;
+module_param_named(coalesce_thresh, smd_coalesce_thresh,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static int smd_poll_interval_us = 1000;
+module_param_named(poll_interval_us, smd_poll_interval_us,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static int smd_poll_budget = 16;
+module_param_named(poll_budget, smd_poll_budget,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static int smd_poll_idle = 4;
+module_param_named(poll_idle, smd_poll_idle,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+#define SMD_COALESCE_WINDOW (HZ / 10)
+
 #if defined(CONFIG_MSM_SMD_DEBUG)
 #define SMD_DBG(x...) do {				\
 		if (msm_smd_debug_mask & MSM_SMD_DEBUG) \
@@ -742,6 +769,21 @@ struct smd_channel {
 	char is_pkt_ch;
 
 	struct smd_half_channel_access *half_ch;
+
+	/* Interrupt coalescing, see smd_ch_check_rate() */
+	struct list_head poll_list;
+	int polled;
+	unsigned long window_start;
+	unsigned window_events;
+	unsigned idle_polls;
+	unsigned last_head;
+
+	unsigned irq_events;
+	unsigned poll_events;
+	unsigned polls;
+	unsigned mode_switches;
+	unsigned packets;
+	unsigned long bytes;
 };
 
 struct edge_to_pid {
@@ -1130,6 +1172,7 @@ static void update_packet_state(struct smd_channel *ch)
 		BUG_ON(r != SMD_HEADER_SIZE);
 
 		ch->current_packet = hdr[0];
+		ch->packets++;
 	}
 }
 
@@ -1247,57 +1290,197 @@ static void handle_smd_irq_closing_list(void)
 	spin_unlock_irqrestore(&smd_lock, flags);
 }
 
+/* Call with smd_lock held, returns 1 if the channel was notified of data */
+static int smd_ch_service(struct smd_channel *ch)
+{
+	unsigned ch_flags = 0;
+	unsigned char state_change = 0;
+	unsigned tmp;
+
+	if (ch_is_open(ch)) {
+		if (ch->half_ch->get_fHEAD(ch->recv)) {
+			ch->half_ch->set_fHEAD(ch->recv, 0);
+			ch_flags |= 1;
+		}
+		if (ch->half_ch->get_fTAIL(ch->recv)) {
+			ch->half_ch->set_fTAIL(ch->recv, 0);
+			ch_flags |= 2;
+		}
+		if (ch->half_ch->get_fSTATE(ch->recv)) {
+			ch->half_ch->set_fSTATE(ch->recv, 0);
+			ch_flags |= 4;
+		}
+	}
+	tmp = ch->half_ch->get_state(ch->recv);
+	if (tmp != ch->last_state) {
+		SMx_POWER_INFO("SMD ch%d '%s' State change %d->%d\n",
+				ch->n, ch->name, ch->last_state, tmp);
+		smd_state_change(ch, ch->last_state, tmp);
+		state_change = 1;
+	}
+	if (ch_flags & 0x3) {
+		tmp = ch->half_ch->get_head(ch->recv);
+		ch->bytes += (tmp - ch->last_head) & ch->fifo_mask;
+		ch->last_head = tmp;
+
+		ch->update_state(ch);
+		SMx_POWER_INFO("SMD ch%d '%s' Data event r%d/w%d\n",
+				ch->n, ch->name,
+				ch->read_avail(ch),
+				ch->fifo_size - ch->write_avail(ch));
+		ch->notify(ch->priv, SMD_EVENT_DATA);
+	}
+	if (ch_flags & 0x4 && !state_change) {
+		SMx_POWER_INFO("SMD ch%d '%s' State update\n",
+				ch->n, ch->name);
+		ch->notify(ch->priv, SMD_EVENT_STATUS);
+	}
+
+	return !!(ch_flags & 0x3);
+}
+
+static LIST_HEAD(smd_ch_list_polled);
+static struct hrtimer smd_poll_timer;
+static int smd_poll_armed;
+
+static inline ktime_t smd_poll_interval(void)
+{
+	return ns_to_ktime((u64)max(smd_poll_interval_us, 1) * NSEC_PER_USEC);
+}
+
+/* Call with smd_lock held after a data event delivered from interrupt */
+static void smd_ch_check_rate(struct smd_channel *ch)
+{
+	if (!smd_coalesce_thresh)
+		return;
+
+	if (time_after(jiffies, ch->window_start + SMD_COALESCE_WINDOW)) {
+		ch->window_start = jiffies;
+		ch->window_events = 0;
+	}
+	if (++ch->window_events < smd_coalesce_thresh)
+		return;
+
+	SMD_DBG("SMD ch%d '%s' switching to polling\n", ch->n, ch->name);
+	ch->polled = 1;
+	ch->idle_polls = 0;
+	ch->mode_switches++;
+	list_add_tail(&ch->poll_list, &smd_ch_list_polled);
+
+	if (!smd_poll_armed) {
+		smd_poll_armed = 1;
+		hrtimer_start(&smd_poll_timer, smd_poll_interval(),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+static enum hrtimer_restart smd_poll_fn(struct hrtimer *timer)
+{
+	struct smd_channel *ch, *index;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	/* Let every poll service a channel, so polled ones can drain */
+	int budget = max(smd_poll_budget, 1);
+	unsigned long flags;
+	LIST_HEAD(polled);
+
+	spin_lock_irqsave(&smd_lock, flags);
+	list_for_each_entry_safe(ch, index, &smd_ch_list_polled, poll_list) {
+		if (budget <= 0)
+			break;
+
+		ch->polls++;
+		list_move_tail(&ch->poll_list, &polled);
+		if (smd_ch_service(ch)) {
+			ch->poll_events++;
+			ch->idle_polls = 0;
+			budget--;
+			/* With coalescing off even busy channels go back */
+			if (smd_coalesce_thresh)
+				continue;
+		} else if (smd_coalesce_thresh &&
+			   ++ch->idle_polls < smd_poll_idle) {
+			continue;
+		}
+
+		SMD_DBG("SMD ch%d '%s' back to interrupts\n", ch->n, ch->name);
+		list_del(&ch->poll_list);
+		ch->polled = 0;
+		ch->window_events = 0;
+	}
+	/* Whatever the budget left out goes first next time */
+	list_splice_tail(&polled, &smd_ch_list_polled);
+
+	if (!list_empty(&smd_ch_list_polled)) {
+		hrtimer_forward_now(timer, smd_poll_interval());
+		ret = HRTIMER_RESTART;
+	} else {
+		smd_poll_armed = 0;
+	}
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return ret;
+}
+
 static void handle_smd_irq(struct list_head *list, void (*notify)(void))
 {
 	unsigned long flags;
 	struct smd_channel *ch;
-	unsigned ch_flags;
-	unsigned tmp;
-	unsigned char state_change;
 
 	spin_lock_irqsave(&smd_lock, flags);
 	list_for_each_entry(ch, list, ch_list) {
-		state_change = 0;
-		ch_flags = 0;
-		if (ch_is_open(ch)) {
-			if (ch->half_ch->get_fHEAD(ch->recv)) {
-				ch->half_ch->set_fHEAD(ch->recv, 0);
-				ch_flags |= 1;
-			}
-			if (ch->half_ch->get_fTAIL(ch->recv)) {
-				ch->half_ch->set_fTAIL(ch->recv, 0);
-				ch_flags |= 2;
-			}
-			if (ch->half_ch->get_fSTATE(ch->recv)) {
-				ch->half_ch->set_fSTATE(ch->recv, 0);
-				ch_flags |= 4;
-			}
-		}
-		tmp = ch->half_ch->get_state(ch->recv);
-		if (tmp != ch->last_state) {
-			SMx_POWER_INFO("SMD ch%d '%s' State change %d->%d\n",
-					ch->n, ch->name, ch->last_state, tmp);
-			smd_state_change(ch, ch->last_state, tmp);
-			state_change = 1;
-		}
-		if (ch_flags & 0x3) {
-			ch->update_state(ch);
-			SMx_POWER_INFO("SMD ch%d '%s' Data event r%d/w%d\n",
-					ch->n, ch->name,
-					ch->read_avail(ch),
-					ch->fifo_size - ch->write_avail(ch));
-			ch->notify(ch->priv, SMD_EVENT_DATA);
-		}
-		if (ch_flags & 0x4 && !state_change) {
-			SMx_POWER_INFO("SMD ch%d '%s' State update\n",
-					ch->n, ch->name);
-			ch->notify(ch->priv, SMD_EVENT_STATUS);
+		/* The poll timer takes care of these */
+		if (ch->polled)
+			continue;
+
+		if (smd_ch_service(ch)) {
+			ch->irq_events++;
+			smd_ch_check_rate(ch);
 		}
 	}
 	spin_unlock_irqrestore(&smd_lock, flags);
 	do_smd_probe();
 }
 
+/**
+ * smd_coalesce_stats() - Print the coalescing counters of open channels
+ * @buf: buffer to print to
+ * @max: size of @buf
+ *
+ * Return: the number of characters written
+ */
+int smd_coalesce_stats(char *buf, int max)
+{
+	struct list_head *lists[] = {
+		&smd_ch_list_modem, &smd_ch_list_dsp, &smd_ch_list_dsps,
+		&smd_ch_list_wcnss, &smd_ch_list_rpm, &smd_ch_list_loopback,
+	};
+	struct smd_channel *ch;
+	unsigned long flags;
+	unsigned wakeups;
+	int i, n = 0;
+
+	n += scnprintf(buf + n, max - n,
+		       "%-20s %4s %9s %9s %9s %6s %9s %11s %6s\n",
+		       "channel", "mode", "irq_ev", "poll_ev", "polls",
+		       "switch", "packets", "bytes", "pkt/ev");
+
+	spin_lock_irqsave(&smd_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry(ch, lists[i], ch_list) {
+			wakeups = ch->irq_events + ch->poll_events;
+			n += scnprintf(buf + n, max - n,
+				"%-20s %4s %9u %9u %9u %6u %9u %11lu %6u\n",
+				ch->name, ch->polled ? "poll" : "irq",
+				ch->irq_events, ch->poll_events, ch->polls,
+				ch->mode_switches, ch->packets, ch->bytes,
+				wakeups ? ch->packets / wakeups : 0);
+		}
+	}
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return n;
+}
+
 static irqreturn_t smd_modem_irq_handler(int irq, void *data)
 {
 	SMx_POWER_INFO("SMD Int Modem->Apps\n");
@@ -1721,50 +1904,74 @@ static int smd_alloc_channel(struct smd_alloc_elm *alloc_elm)
 	return 0;
 }
 
-static inline void notify_loopback_smd(void)
+static void smd_loopback_irq_handler(unsigned long arg);
+static DECLARE_TASKLET(smd_loopback_tasklet, smd_loopback_irq_handler, 0);
+
+/*
+ * Both ends of a local loopback channel are on this cpu, "interrupt" it
+ * from a tasklet so readers are notified the way they would be by a
+ * real remote processor.
+ */
+static void notify_loopback_smd(void)
 {
-	unsigned long flags;
-	struct smd_channel *ch;
+	tasklet_schedule(&smd_loopback_tasklet);
+}
 
-	spin_lock_irqsave(&smd_lock, flags);
-	list_for_each_entry(ch, &smd_ch_list_loopback, ch_list) {
-		ch->notify(ch->priv, SMD_EVENT_DATA);
-	}
-	spin_unlock_irqrestore(&smd_lock, flags);
+static void smd_loopback_irq_handler(unsigned long arg)
+{
+	handle_smd_irq(&smd_ch_list_loopback, notify_loopback_smd);
 }
 
-static int smd_alloc_loopback_channel(void)
+/* A half channel and fifo looping back onto itself */
+struct smd_loopback_fifo {
+	struct smd_half_channel ctl;
+	char data[SMD_BUF_SIZE];
+};
+
+static int smd_alloc_loopback_channel(const char *name, int is_pkt)
 {
-	static struct smd_half_channel smd_loopback_ctl;
-	static char smd_loopback_data[SMD_BUF_SIZE];
+	struct smd_loopback_fifo *fifo;
 	struct smd_channel *ch;
 
 	ch = kzalloc(sizeof(struct smd_channel), GFP_KERNEL);
-	if (ch == 0) {
+	fifo = kzalloc(sizeof(*fifo), GFP_KERNEL);
+	if (ch == 0 || fifo == 0) {
 		pr_err("%s: out of memory\n", __func__);
+		kfree(ch);
+		kfree(fifo);
 		return -1;
 	}
 	ch->n = SMD_LOOPBACK_CID;
 
-	ch->send = &smd_loopback_ctl;
-	ch->recv = &smd_loopback_ctl;
-	ch->send_data = smd_loopback_data;
-	ch->recv_data = smd_loopback_data;
+	ch->send = &fifo->ctl;
+	ch->recv = &fifo->ctl;
+	ch->send_data = fifo->data;
+	ch->recv_data = fifo->data;
 	ch->fifo_size = SMD_BUF_SIZE;
 
 	ch->fifo_mask = ch->fifo_size - 1;
 	ch->type = SMD_LOOPBACK_TYPE;
 	ch->notify_other_cpu = notify_loopback_smd;
+	ch->half_ch = get_half_ch_funcs(ch->type);
 
-	ch->read = smd_stream_read;
-	ch->write = smd_stream_write;
-	ch->read_avail = smd_stream_read_avail;
-	ch->write_avail = smd_stream_write_avail;
-	ch->update_state = update_stream_state;
-	ch->read_from_cb = smd_stream_read;
+	if (is_pkt) {
+		ch->read = smd_packet_read;
+		ch->write = smd_packet_write;
+		ch->read_avail = smd_packet_read_avail;
+		ch->write_avail = smd_packet_write_avail;
+		ch->update_state = update_packet_state;
+		ch->read_from_cb = smd_packet_read_from_cb;
+		ch->is_pkt_ch = 1;
+	} else {
+		ch->read = smd_stream_read;
+		ch->write = smd_stream_write;
+		ch->read_avail = smd_stream_read_avail;
+		ch->write_avail = smd_stream_write_avail;
+		ch->update_state = update_stream_state;
+		ch->read_from_cb = smd_stream_read;
+	}
 
-	memset(ch->name, 0, 20);
-	memcpy(ch->name, "local_loopback", 14);
+	strlcpy(ch->name, name, sizeof(ch->name));
 
 	ch->pdev.name = ch->name;
 	ch->pdev.id = ch->type;
@@ -1869,6 +2076,7 @@ int smd_named_open_on_edge(const char *name, uint32_t edge,
 	ch->notify = notify;
 	ch->current_packet = 0;
 	ch->last_state = SMD_SS_CLOSED;
+	ch->last_head = ch->half_ch->get_head(ch->recv);
 	ch->priv = priv;
 
 	if (edge == SMD_LOOPBACK_TYPE) {
@@ -1928,6 +2136,10 @@ int smd_close(smd_channel_t *ch)
 
 	spin_lock_irqsave(&smd_lock, flags);
 	list_del(&ch->ch_list);
+	if (ch->polled) {
+		list_del(&ch->poll_list);
+		ch->polled = 0;
+	}
 	if (ch->n == SMD_LOOPBACK_CID) {
 		ch->half_ch->set_fDSR(ch->send, 0);
 		ch->half_ch->set_fCTS(ch->send, 0);
@@ -2120,6 +2332,17 @@ int smd_write_avail(smd_channel_t *ch)
 }
 EXPORT_SYMBOL(smd_write_avail);
 
+int smd_total_fifo_size(smd_channel_t *ch)
+{
+	if (!ch) {
+		pr_err("%s: Invalid channel specified\n", __func__);
+		return -ENODEV;
+	}
+
+	return ch->fifo_size;
+}
+EXPORT_SYMBOL(smd_total_fifo_size);
+
 void smd_enable_read_intr(smd_channel_t *ch)
 {
 	if (ch)
@@ -3353,6 +3576,8 @@ static int __devinit msm_smd_probe(struct platform_device *pdev)
 
 	SMD_INFO("smd probe\n");
 	INIT_WORK(&probe_work, smd_channel_probe_worker);
+	hrtimer_init(&smd_poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	smd_poll_timer.function = smd_poll_fn;
 
 	channel_close_wq = create_singlethread_workqueue("smd_channel_close");
 	if (IS_ERR(channel_close_wq)) {
@@ -3390,7 +3615,8 @@ static int __devinit msm_smd_probe(struct platform_device *pdev)
 
 	smd_initialized = 1;
 
-	smd_alloc_loopback_channel();
+	smd_alloc_loopback_channel(SMD_LOOPBACK_NAME, 0);
+	smd_alloc_loopback_channel(SMD_LOOPBACK_PKT_NAME, 1);
 	smsm_irq_handler(0, 0);
 	tasklet_schedule(&smd_fake_irq_tasklet);
 
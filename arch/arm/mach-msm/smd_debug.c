@@ -774,6 +774,7 @@ static int __init smd_debugfs_init(void)
 	debug_create("print_f3", 0444, dent, debug_f3);
 	debug_create("int_stats", 0444, dent, debug_int_stats);
 	debug_create("int_stats_reset", 0444, dent, debug_int_stats_reset);
+	debug_create("coalesce", 0444, dent, smd_coalesce_stats);
 
 	
 	debug_create("build", 0444, dent, debug_read_build_id);
@@ -0,0 +1,388 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * SMD loopback benchmark.
+ *
+ * Sends numbered messages over one of the local loopback channels and
+ * reads them back, so the cost of the SMD core can be measured without
+ * a remote processor.  Writes are done in bursts, the time from the
+ * start of a burst to the first data notification is the notify
+ * latency, and the time spent in smd_read() is accounted separately to
+ * compare the stream and packet read paths.
+ *
+ * Everything is driven from debugfs:
+ *
+ *   cd /sys/kernel/debug/smd_bench
+ *   echo 1 > packet; echo 512 > size; echo 4 > burst; echo 0 > rate
+ *   echo 1 > run
+ *   cat results
+ *
+ * A rate of 0 sends as fast as possible, otherwise messages are paced
+ * to that many per second.
+ */
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include <mach/msm_smd.h>
+
+#include "smd_private.h"
+
+#define SMD_BENCH_TIMEOUT	HZ
+#define SMD_BENCH_MAX_COUNT	1000000
+
+/**
+ * struct smd_bench_params - what to run
+ * @packet: use the packet channel rather than the stream one
+ * @size: bytes per message
+ * @count: number of messages per run
+ * @burst: messages written before reading them back
+ * @rate: messages per second, 0 for no pacing
+ */
+struct smd_bench_params {
+	u32 packet;
+	u32 size;
+	u32 count;
+	u32 burst;
+	u32 rate;
+};
+
+/**
+ * struct smd_bench - state of the benchmark
+ * @lock: serializes runs and protects the results
+ * @ch: loopback channel used by the current run
+ * @wait: woken on every data notification
+ * @notified: set once @notify_ns is valid
+ * @notify_ns: time of the first data notification of the current burst
+ * @params: parameters set through debugfs
+ * @run: parameters of the last run
+ * @ret: result of the last run
+ * @elapsed_ns: duration of the last run
+ * @read_ns: time spent in smd_read() during the last run
+ * @read_calls: number of calls to smd_read() during the last run
+ * @nr_lat: number of notify latency samples
+ * @lat: notify latency in nanoseconds of each burst, sorted after a run
+ */
+struct smd_bench {
+	struct mutex lock;
+	smd_channel_t *ch;
+	wait_queue_head_t wait;
+	int notified;
+	u64 notify_ns;
+
+	struct smd_bench_params params;
+	struct smd_bench_params run;
+
+	int ret;
+	u64 elapsed_ns;
+	u64 read_ns;
+	u32 read_calls;
+	u32 nr_lat;
+	u32 *lat;
+};
+
+static struct smd_bench smd_bench = {
+	.params = {
+		.size = 256,
+		.count = 10000,
+		.burst = 1,
+	},
+};
+
+static struct dentry *smd_bench_dent;
+
+static inline u64 smd_bench_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void smd_bench_notify(void *priv, unsigned event)
+{
+	struct smd_bench *b = priv;
+
+	if (event != SMD_EVENT_DATA)
+		return;
+
+	/* Our own reads raise data events as well, only count new data */
+	if (!b->notified && smd_read_avail(b->ch) > 0) {
+		b->notify_ns = smd_bench_now();
+		smp_wmb();
+		b->notified = 1;
+	}
+	wake_up(&b->wait);
+}
+
+static void smd_bench_fill(char *buf, u32 size, u32 seq)
+{
+	u32 i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = seq + i;
+}
+
+static int smd_bench_check(const char *buf, u32 size, u32 seq)
+{
+	u32 i;
+
+	for (i = 0; i < size; i++)
+		if (buf[i] != (char)(seq + i))
+			return -EILSEQ;
+
+	return 0;
+}
+
+/* Reads back one message of @size bytes */
+static int smd_bench_read(struct smd_bench *b, char *buf, u32 size)
+{
+	u32 got = 0;
+	u64 start;
+	int r;
+
+	while (got < size) {
+		if (!wait_event_timeout(b->wait, smd_read_avail(b->ch) > 0,
+					SMD_BENCH_TIMEOUT))
+			return -ETIMEDOUT;
+
+		start = smd_bench_now();
+		r = smd_read(b->ch, buf + got, size - got);
+		b->read_ns += smd_bench_now() - start;
+		b->read_calls++;
+		if (r < 0)
+			return r;
+		got += r;
+	}
+
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int smd_bench_run(struct smd_bench *b)
+{
+	struct smd_bench_params *p = &b->run;
+	u32 i = 0, j = 0, n, nr_bursts;
+	u64 start, now, next;
+	char *buf;
+	int r;
+
+	*p = b->params;
+	b->elapsed_ns = 0;
+	if (!p->size || !p->count || !p->burst ||
+	    p->count > SMD_BENCH_MAX_COUNT ||
+	    p->size >= SMD_BUF_SIZE || p->burst >= SMD_BUF_SIZE ||
+	    p->burst * (p->size + SMD_HEADER_SIZE) >= SMD_BUF_SIZE)
+		return -EINVAL;
+
+	nr_bursts = DIV_ROUND_UP(p->count, p->burst);
+	vfree(b->lat);
+	b->lat = vmalloc(nr_bursts * sizeof(*b->lat));
+	buf = kmalloc(p->size, GFP_KERNEL);
+	if (!b->lat || !buf) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	b->nr_lat = 0;
+	b->read_ns = 0;
+	b->read_calls = 0;
+
+	r = smd_named_open_on_edge(p->packet ? SMD_LOOPBACK_PKT_NAME :
+				   SMD_LOOPBACK_NAME, SMD_LOOPBACK_TYPE,
+				   &b->ch, b, smd_bench_notify);
+	if (r < 0) {
+		pr_err("%s: loopback channel open failed %d\n", __func__, r);
+		goto out;
+	}
+
+	start = smd_bench_now();
+	for (i = 0; i < p->count; i += n) {
+		n = min(p->burst, p->count - i);
+
+		b->notified = 0;
+		now = smd_bench_now();
+		for (j = 0; j < n; j++) {
+			smd_bench_fill(buf, p->size, i + j);
+			r = smd_write(b->ch, buf, p->size);
+			if (r != p->size) {
+				r = r < 0 ? r : -EIO;
+				goto close;
+			}
+		}
+
+		if (!wait_event_timeout(b->wait, b->notified,
+					SMD_BENCH_TIMEOUT)) {
+			r = -ETIMEDOUT;
+			goto close;
+		}
+		smp_rmb();
+		b->lat[b->nr_lat++] = b->notify_ns - now;
+
+		for (j = 0; j < n; j++) {
+			r = smd_bench_read(b, buf, p->size);
+			if (!r)
+				r = smd_bench_check(buf, p->size, i + j);
+			if (r)
+				goto close;
+		}
+
+		if (p->rate) {
+			next = start + div_u64((u64)(i + n) * NSEC_PER_SEC,
+					       p->rate);
+			now = smd_bench_now();
+			if (next > now) {
+				next = div_u64(next - now, NSEC_PER_USEC);
+				usleep_range(next, next + 50);
+			}
+		}
+	}
+	b->elapsed_ns = smd_bench_now() - start;
+	r = 0;
+
+	sort(b->lat, b->nr_lat, sizeof(*b->lat), cmp_u32, NULL);
+close:
+	if (r)
+		pr_err("%s: failed at message %u: %d\n", __func__, i + j, r);
+	smd_close(b->ch);
+	b->ch = NULL;
+out:
+	kfree(buf);
+	return r;
+}
+
+static int smd_bench_run_set(void *data, u64 val)
+{
+	struct smd_bench *b = data;
+	int r;
+
+	if (!val)
+		return -EINVAL;
+
+	mutex_lock(&b->lock);
+	r = b->ret = smd_bench_run(b);
+	mutex_unlock(&b->lock);
+
+	return r;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(smd_bench_run_fops, NULL, smd_bench_run_set,
+			"%llu\n");
+
+static u32 smd_bench_pct(struct smd_bench *b, int pct)
+{
+	return b->lat[(b->nr_lat - 1) * pct / 100];
+}
+
+static int smd_bench_results_show(struct seq_file *s, void *unused)
+{
+	struct smd_bench *b = s->private;
+	struct smd_bench_params *p = &b->run;
+	u64 elapsed_us;
+
+	mutex_lock(&b->lock);
+	if (b->ret || !b->elapsed_ns) {
+		seq_printf(s, "no results (last run: %d)\n", b->ret);
+		goto out;
+	}
+
+	elapsed_us = max_t(u64, div_u64(b->elapsed_ns, NSEC_PER_USEC), 1);
+	seq_printf(s, "channel %s size %u count %u burst %u rate %u\n",
+		   p->packet ? "packet" : "stream", p->size, p->count,
+		   p->burst, p->rate);
+	seq_printf(s, "elapsed_us %llu\n", elapsed_us);
+	seq_printf(s, "bytes_per_sec %llu\n",
+		   div64_u64((u64)p->size * p->count * USEC_PER_SEC,
+			     elapsed_us));
+	seq_printf(s, "msgs_per_sec %llu\n",
+		   div64_u64((u64)p->count * USEC_PER_SEC, elapsed_us));
+	seq_printf(s, "notify_ns p50 %u p90 %u p99 %u max %u\n",
+		   smd_bench_pct(b, 50), smd_bench_pct(b, 90),
+		   smd_bench_pct(b, 99), b->lat[b->nr_lat - 1]);
+	seq_printf(s, "read_calls %u read_ns_per_call %llu "
+		   "read_ns_per_kb %llu\n", b->read_calls,
+		   div_u64(b->read_ns, b->read_calls),
+		   div64_u64(b->read_ns * 1024, (u64)p->size * p->count));
+out:
+	mutex_unlock(&b->lock);
+	return 0;
+}
+
+static int smd_bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, smd_bench_results_show, inode->i_private);
+}
+
+static const struct file_operations smd_bench_results_fops = {
+	.owner = THIS_MODULE,
+	.open = smd_bench_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init smd_bench_init(void)
+{
+	struct smd_bench *b = &smd_bench;
+
+	mutex_init(&b->lock);
+	init_waitqueue_head(&b->wait);
+
+	smd_bench_dent = debugfs_create_dir("smd_bench", NULL);
+	if (IS_ERR_OR_NULL(smd_bench_dent))
+		return -ENODEV;
+
+	debugfs_create_u32("packet", 0644, smd_bench_dent,
+			   &b->params.packet);
+	debugfs_create_u32("size", 0644, smd_bench_dent,
+			   &b->params.size);
+	debugfs_create_u32("count", 0644, smd_bench_dent,
+			   &b->params.count);
+	debugfs_create_u32("burst", 0644, smd_bench_dent,
+			   &b->params.burst);
+	debugfs_create_u32("rate", 0644, smd_bench_dent,
+			   &b->params.rate);
+	debugfs_create_file("run", 0200, smd_bench_dent, b,
+			    &smd_bench_run_fops);
+	debugfs_create_file("results", 0444, smd_bench_dent, b,
+			    &smd_bench_results_fops);
+
+	return 0;
+}
+
+static void __exit smd_bench_exit(void)
+{
+	debugfs_remove_recursive(smd_bench_dent);
+	vfree(smd_bench.lat);
+}
+
+module_init(smd_bench_init);
+module_exit(smd_bench_exit);
+
+MODULE_DESCRIPTION("MSM SMD loopback benchmark");
+MODULE_LICENSE("GPL v2");
@@ -26,6 +26,10 @@
 #include <linux/completion.h>
 #include <linux/msm_smd_pkt.h>
 #include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <asm/ioctls.h>
 #include <linux/wakelock.h>
 
@@ -81,6 +85,24 @@
 #define DEVICE_NAME "smdpkt"
 #define WAKELOCK_TIMEOUT (2*HZ)
 
+/**
+ * struct smd_pkt_ring - receive ring mapped by userspace
+ * @ref: held by the device and by each mapping of the ring
+ * @base: the header followed by the slots, see msm_smd_pkt.h
+ * @size: size of @base, page aligned
+ * @nr_slots: number of slots, a power of two
+ * @slot_size: bytes per slot, including the length word
+ * @head: next slot to fill, the copy in the header is only written to
+ */
+struct smd_pkt_ring {
+	struct kref ref;
+	void *base;
+	size_t size;
+	unsigned int nr_slots;
+	unsigned int slot_size;
+	unsigned int head;
+};
+
 struct smd_pkt_dev {
 	struct cdev cdev;
 	struct device *devicep;
@@ -111,6 +133,9 @@ struct smd_pkt_dev {
 	struct work_struct packet_arrival_work;
 	struct spinlock pa_spinlock;
 	int wakelock_locked;
+	/* Never held across sleeps or user copies, mmap_sem nests outside */
+	spinlock_t ring_lock;
+	struct smd_pkt_ring *ring;
 } *smd_pkt_devp[NUM_SMD_PKT_PORTS];
 
 struct class *smd_pkt_classp;
@@ -118,6 +143,13 @@ static dev_t smd_pkt_number;
 static struct delayed_work loopback_work;
 static void check_and_wakeup_reader(struct smd_pkt_dev *smd_pkt_devp);
 static void check_and_wakeup_writer(struct smd_pkt_dev *smd_pkt_devp);
+static long smd_pkt_readv(struct smd_pkt_dev *smd_pkt_devp,
+			  struct smd_pkt_batch __user *ubatch);
+static long smd_pkt_writev(struct smd_pkt_dev *smd_pkt_devp,
+			   struct smd_pkt_batch __user *ubatch);
+static long smd_pkt_ring_setup(struct smd_pkt_dev *smd_pkt_devp,
+			       struct smd_pkt_ring_req __user *ureq);
+static long smd_pkt_ring_wait(struct smd_pkt_dev *smd_pkt_devp);
 static uint32_t is_modem_smsm_inited(void);
 
 static int msm_smd_pkt_debug_mask;
@@ -304,6 +336,18 @@ static long smd_pkt_ioctl(struct file *file, unsigned int cmd,
 	case SMD_PKT_IOCTL_BLOCKING_WRITE:
 		ret = get_user(smd_pkt_devp->blocking_write, (int *)arg);
 		break;
+	case SMD_PKT_IOCTL_READV:
+		ret = smd_pkt_readv(smd_pkt_devp, (void __user *)arg);
+		break;
+	case SMD_PKT_IOCTL_WRITEV:
+		ret = smd_pkt_writev(smd_pkt_devp, (void __user *)arg);
+		break;
+	case SMD_PKT_IOCTL_RING_SETUP:
+		ret = smd_pkt_ring_setup(smd_pkt_devp, (void __user *)arg);
+		break;
+	case SMD_PKT_IOCTL_RING_FILL:
+		ret = smd_pkt_ring_wait(smd_pkt_devp);
+		break;
 	default:
 		pr_err("%s: Unrecognized ioctl command %d\n", __func__, cmd);
 		ret = -1;
@@ -312,38 +356,14 @@ static long smd_pkt_ioctl(struct file *file, unsigned int cmd,
 	return ret;
 }
 
-ssize_t smd_pkt_read(struct file *file,
-		       char __user *buf,
-		       size_t count,
-		       loff_t *ppos)
+/*
+ * Waits until a packet starts to arrive.  Returns its size with rx_lock
+ * held, or a negative error without it.
+ */
+static int smd_pkt_wait_packet(struct smd_pkt_dev *smd_pkt_devp)
 {
 	int r;
-	int bytes_read;
 	int pkt_size;
-	struct smd_pkt_dev *smd_pkt_devp;
-	unsigned long flags;
-
-	smd_pkt_devp = file->private_data;
-
-	if (!smd_pkt_devp) {
-		pr_err("%s on NULL smd_pkt_dev\n", __func__);
-		return -EINVAL;
-	}
-
-	if (!smd_pkt_devp->ch) {
-		pr_err("%s on a closed smd_pkt_dev id:%d\n",
-			__func__, smd_pkt_devp->i);
-		return -EINVAL;
-	}
-
-	if (smd_pkt_devp->do_reset_notification) {
-		
-		pr_err("%s notifying reset for smd_pkt_dev id:%d\n",
-			__func__, smd_pkt_devp->i);
-		return notify_reset(smd_pkt_devp);
-	}
-	D_READ("Begin %s on smd_pkt_dev id:%d buffer_size %d\n",
-		__func__, smd_pkt_devp->i, count);
 
 wait_for_packet:
 	r = wait_event_interruptible(smd_pkt_devp->ch_read_wait_queue,
@@ -389,11 +409,20 @@ wait_for_packet:
 		goto wait_for_packet;
 	}
 
+	return pkt_size;
+}
+
+/* Called with rx_lock held, copies the current packet of @pkt_size to @buf */
+static int smd_pkt_read_packet(struct smd_pkt_dev *smd_pkt_devp,
+			       char __user *buf, size_t count, int pkt_size)
+{
+	int r;
+	int bytes_read;
+
 	if (pkt_size > count) {
 		pr_err("%s: failure on smd_pkt_dev id: %d - packet size %d"
 		       " > buffer size %d,", __func__, smd_pkt_devp->i,
 			pkt_size, count);
-		mutex_unlock(&smd_pkt_devp->rx_lock);
 		return -ETOOSMALL;
 	}
 
@@ -403,7 +432,6 @@ wait_for_packet:
 					 (buf + bytes_read),
 					 (pkt_size - bytes_read));
 		if (r < 0) {
-			mutex_unlock(&smd_pkt_devp->rx_lock);
 			if (smd_pkt_devp->has_reset) {
 				pr_err("%s notifying reset for smd_pkt_dev"
 				       " id:%d\n", __func__, smd_pkt_devp->i);
@@ -418,14 +446,30 @@ wait_for_packet:
 				   smd_read_avail(smd_pkt_devp->ch) ||
 				   smd_pkt_devp->has_reset);
 		if (smd_pkt_devp->has_reset) {
-			mutex_unlock(&smd_pkt_devp->rx_lock);
 			pr_err("%s notifying reset for smd_pkt_dev  id:%d\n",
 				__func__, smd_pkt_devp->i);
 			return notify_reset(smd_pkt_devp);
 		}
 	} while (pkt_size != bytes_read);
 	D_READ_DUMP_BUFFER("Read: ", (bytes_read > 16 ? 16 : bytes_read), buf);
-	mutex_unlock(&smd_pkt_devp->rx_lock);
+
+	return bytes_read;
+}
+
+/* Size of the next packet if all of it is in the fifo, 0 otherwise */
+static int smd_pkt_next_packet(struct smd_pkt_dev *smd_pkt_devp)
+{
+	int pkt_size = smd_cur_packet_size(smd_pkt_devp->ch);
+
+	if (pkt_size <= 0 || smd_read_avail(smd_pkt_devp->ch) < pkt_size)
+		return 0;
+
+	return pkt_size;
+}
+
+static void smd_pkt_read_done(struct smd_pkt_dev *smd_pkt_devp)
+{
+	unsigned long flags;
 
 	mutex_lock(&smd_pkt_devp->ch_lock);
 	spin_lock_irqsave(&smd_pkt_devp->pa_spinlock, flags);
@@ -440,23 +484,18 @@ wait_for_packet:
 	spin_unlock_irqrestore(&smd_pkt_devp->pa_spinlock, flags);
 	mutex_unlock(&smd_pkt_devp->ch_lock);
 
-	D_READ("Finished %s on smd_pkt_dev id:%d  %d bytes\n",
-		__func__, smd_pkt_devp->i, bytes_read);
-
 	
 	check_and_wakeup_reader(smd_pkt_devp);
-
-	return bytes_read;
 }
 
-ssize_t smd_pkt_write(struct file *file,
-		       const char __user *buf,
+ssize_t smd_pkt_read(struct file *file,
+		       char __user *buf,
 		       size_t count,
 		       loff_t *ppos)
 {
-	int r = 0, bytes_written;
+	int bytes_read;
+	int pkt_size;
 	struct smd_pkt_dev *smd_pkt_devp;
-	DEFINE_WAIT(write_wait);
 
 	smd_pkt_devp = file->private_data;
 
@@ -471,28 +510,41 @@ ssize_t smd_pkt_write(struct file *file,
 		return -EINVAL;
 	}
 
-	if (smd_pkt_devp->do_reset_notification || smd_pkt_devp->has_reset) {
+	if (smd_pkt_devp->do_reset_notification) {
+		
 		pr_err("%s notifying reset for smd_pkt_dev id:%d\n",
 			__func__, smd_pkt_devp->i);
-		
 		return notify_reset(smd_pkt_devp);
 	}
-	D_WRITE("Begin %s on smd_pkt_dev id:%d data_size %d\n",
+	D_READ("Begin %s on smd_pkt_dev id:%d buffer_size %d\n",
 		__func__, smd_pkt_devp->i, count);
 
-	mutex_lock(&smd_pkt_devp->tx_lock);
-	if (!smd_pkt_devp->blocking_write) {
-		if (smd_write_avail(smd_pkt_devp->ch) < count) {
-			pr_err("%s: Not enough space in smd_pkt_dev id:%d\n",
-				   __func__, smd_pkt_devp->i);
-			mutex_unlock(&smd_pkt_devp->tx_lock);
-			return -ENOMEM;
-		}
-	}
+	pkt_size = smd_pkt_wait_packet(smd_pkt_devp);
+	if (pkt_size < 0)
+		return pkt_size;
+
+	bytes_read = smd_pkt_read_packet(smd_pkt_devp, buf, count, pkt_size);
+	mutex_unlock(&smd_pkt_devp->rx_lock);
+	if (bytes_read < 0)
+		return bytes_read;
+
+	smd_pkt_read_done(smd_pkt_devp);
+
+	D_READ("Finished %s on smd_pkt_dev id:%d  %d bytes\n",
+		__func__, smd_pkt_devp->i, bytes_read);
+
+	return bytes_read;
+}
+
+/* Called with tx_lock held, writes @count bytes at @buf as one packet */
+static int smd_pkt_write_packet(struct smd_pkt_dev *smd_pkt_devp,
+				const char __user *buf, size_t count)
+{
+	int r = 0, bytes_written;
+	DEFINE_WAIT(write_wait);
 
 	r = smd_write_start(smd_pkt_devp->ch, count);
 	if (r < 0) {
-		mutex_unlock(&smd_pkt_devp->tx_lock);
 		pr_err("%s: Error:%d in smd_pkt_dev id:%d @ smd_write_start\n",
 			__func__, r, smd_pkt_devp->i);
 		return r;
@@ -511,7 +563,6 @@ ssize_t smd_pkt_write(struct file *file,
 		smd_disable_read_intr(smd_pkt_devp->ch);
 
 		if (smd_pkt_devp->has_reset) {
-			mutex_unlock(&smd_pkt_devp->tx_lock);
 			pr_err("%s notifying reset for smd_pkt_dev id:%d\n",
 				__func__, smd_pkt_devp->i);
 			return notify_reset(smd_pkt_devp);
@@ -520,7 +571,6 @@ ssize_t smd_pkt_write(struct file *file,
 					      (void *)(buf + bytes_written),
 					      (count - bytes_written), 1);
 			if (r < 0) {
-				mutex_unlock(&smd_pkt_devp->tx_lock);
 				if (smd_pkt_devp->has_reset) {
 					pr_err("%s notifying reset for"
 					       " smd_pkt_dev id:%d\n",
@@ -535,15 +585,391 @@ ssize_t smd_pkt_write(struct file *file,
 		}
 	} while (bytes_written != count);
 	smd_write_end(smd_pkt_devp->ch);
-	mutex_unlock(&smd_pkt_devp->tx_lock);
 	D_WRITE_DUMP_BUFFER("Write: ",
 			    (bytes_written > 16 ? 16 : bytes_written), buf);
+
+	return bytes_written;
+}
+
+ssize_t smd_pkt_write(struct file *file,
+		       const char __user *buf,
+		       size_t count,
+		       loff_t *ppos)
+{
+	int r;
+	struct smd_pkt_dev *smd_pkt_devp;
+
+	smd_pkt_devp = file->private_data;
+
+	if (!smd_pkt_devp) {
+		pr_err("%s on NULL smd_pkt_dev\n", __func__);
+		return -EINVAL;
+	}
+
+	if (!smd_pkt_devp->ch) {
+		pr_err("%s on a closed smd_pkt_dev id:%d\n",
+			__func__, smd_pkt_devp->i);
+		return -EINVAL;
+	}
+
+	if (smd_pkt_devp->do_reset_notification || smd_pkt_devp->has_reset) {
+		pr_err("%s notifying reset for smd_pkt_dev id:%d\n",
+			__func__, smd_pkt_devp->i);
+		
+		return notify_reset(smd_pkt_devp);
+	}
+	D_WRITE("Begin %s on smd_pkt_dev id:%d data_size %d\n",
+		__func__, smd_pkt_devp->i, count);
+
+	mutex_lock(&smd_pkt_devp->tx_lock);
+	if (!smd_pkt_devp->blocking_write) {
+		if (smd_write_avail(smd_pkt_devp->ch) < count) {
+			pr_err("%s: Not enough space in smd_pkt_dev id:%d\n",
+				   __func__, smd_pkt_devp->i);
+			mutex_unlock(&smd_pkt_devp->tx_lock);
+			return -ENOMEM;
+		}
+	}
+
+	r = smd_pkt_write_packet(smd_pkt_devp, buf, count);
+	mutex_unlock(&smd_pkt_devp->tx_lock);
+	if (r < 0)
+		return r;
+
 	D_WRITE("Finished %s on smd_pkt_dev id:%d %d bytes\n",
 		__func__, smd_pkt_devp->i, count);
 
 	return count;
 }
 
+static long smd_pkt_readv(struct smd_pkt_dev *smd_pkt_devp,
+			  struct smd_pkt_batch __user *ubatch)
+{
+	struct smd_pkt_batch batch;
+	struct smd_pkt_iovec iov;
+	int pkt_size;
+	int r = 0;
+	unsigned int done = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count || batch.count > SMD_PKT_BATCH_MAX)
+		return -EINVAL;
+
+	if (!smd_pkt_devp->ch)
+		return -EINVAL;
+	if (smd_pkt_devp->do_reset_notification)
+		return notify_reset(smd_pkt_devp);
+
+	pkt_size = smd_pkt_wait_packet(smd_pkt_devp);
+	if (pkt_size < 0)
+		return pkt_size;
+
+	/*
+	 * Only the first packet is waited for, the rest of the batch is
+	 * whatever has already made it into the fifo.
+	 */
+	do {
+		if (copy_from_user(&iov, &batch.iov[done], sizeof(iov))) {
+			r = -EFAULT;
+			break;
+		}
+		r = smd_pkt_read_packet(smd_pkt_devp, iov.buf, iov.len,
+					pkt_size);
+		if (r < 0)
+			break;
+		if (put_user(r, &batch.iov[done].len)) {
+			r = -EFAULT;
+			break;
+		}
+		done++;
+		pkt_size = smd_pkt_next_packet(smd_pkt_devp);
+	} while (done < batch.count && pkt_size);
+	mutex_unlock(&smd_pkt_devp->rx_lock);
+
+	if (done)
+		smd_pkt_read_done(smd_pkt_devp);
+
+	D_READ("%s on smd_pkt_dev id:%d %u packets\n",
+		__func__, smd_pkt_devp->i, done);
+
+	return done ? done : r;
+}
+
+static long smd_pkt_writev(struct smd_pkt_dev *smd_pkt_devp,
+			   struct smd_pkt_batch __user *ubatch)
+{
+	struct smd_pkt_batch batch;
+	struct smd_pkt_iovec iov;
+	int r = 0;
+	unsigned int done;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count || batch.count > SMD_PKT_BATCH_MAX)
+		return -EINVAL;
+
+	if (!smd_pkt_devp->ch)
+		return -EINVAL;
+	if (smd_pkt_devp->do_reset_notification || smd_pkt_devp->has_reset)
+		return notify_reset(smd_pkt_devp);
+
+	mutex_lock(&smd_pkt_devp->tx_lock);
+	for (done = 0; done < batch.count; done++) {
+		if (copy_from_user(&iov, &batch.iov[done], sizeof(iov))) {
+			r = -EFAULT;
+			break;
+		}
+		/* Unless writes block, stop at the first packet not fitting */
+		if (!smd_pkt_devp->blocking_write &&
+		    smd_write_avail(smd_pkt_devp->ch) < iov.len) {
+			r = -ENOMEM;
+			break;
+		}
+		r = smd_pkt_write_packet(smd_pkt_devp, iov.buf, iov.len);
+		if (r < 0)
+			break;
+	}
+	mutex_unlock(&smd_pkt_devp->tx_lock);
+
+	D_WRITE("%s on smd_pkt_dev id:%d %u packets\n",
+		__func__, smd_pkt_devp->i, done);
+
+	return done ? done : r;
+}
+
+static void smd_pkt_ring_free(struct kref *ref)
+{
+	struct smd_pkt_ring *ring = container_of(ref, struct smd_pkt_ring,
+						 ref);
+
+	vfree(ring->base);
+	kfree(ring);
+}
+
+static void smd_pkt_ring_vm_open(struct vm_area_struct *vma)
+{
+	struct smd_pkt_ring *ring = vma->vm_private_data;
+
+	kref_get(&ring->ref);
+}
+
+static void smd_pkt_ring_vm_close(struct vm_area_struct *vma)
+{
+	struct smd_pkt_ring *ring = vma->vm_private_data;
+
+	kref_put(&ring->ref, smd_pkt_ring_free);
+}
+
+static const struct vm_operations_struct smd_pkt_ring_vm_ops = {
+	.open = smd_pkt_ring_vm_open,
+	.close = smd_pkt_ring_vm_close,
+};
+
+static long smd_pkt_ring_setup(struct smd_pkt_dev *smd_pkt_devp,
+			       struct smd_pkt_ring_req __user *ureq)
+{
+	struct smd_pkt_ring_req req;
+	struct smd_pkt_ring_hdr *hdr;
+	struct smd_pkt_ring *ring;
+	size_t size;
+	int r = 0;
+
+	if (copy_from_user(&req, ureq, sizeof(req)))
+		return -EFAULT;
+
+	if (!req.nr_slots || !is_power_of_2(req.nr_slots) ||
+	    req.slot_size <= sizeof(u32) || !IS_ALIGNED(req.slot_size, 4) ||
+	    req.nr_slots > SMD_PKT_RING_MAX_SIZE / req.slot_size)
+		return -EINVAL;
+
+	size = SMD_PKT_RING_HDR_SIZE + req.nr_slots * req.slot_size;
+	if (size > SMD_PKT_RING_MAX_SIZE)
+		return -EINVAL;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->base = vmalloc_user(PAGE_ALIGN(size));
+	if (!ring->base) {
+		kfree(ring);
+		return -ENOMEM;
+	}
+	kref_init(&ring->ref);
+	ring->size = PAGE_ALIGN(size);
+	ring->nr_slots = req.nr_slots;
+	ring->slot_size = req.slot_size;
+
+	hdr = ring->base;
+	hdr->nr_slots = ring->nr_slots;
+	hdr->slot_size = ring->slot_size;
+
+	spin_lock(&smd_pkt_devp->ring_lock);
+	if (smd_pkt_devp->ring)
+		r = -EBUSY;
+	else
+		smd_pkt_devp->ring = ring;
+	spin_unlock(&smd_pkt_devp->ring_lock);
+
+	if (r)
+		kref_put(&ring->ref, smd_pkt_ring_free);
+
+	return r;
+}
+
+/* Returns the ring of the device with a reference held, or NULL */
+static struct smd_pkt_ring *smd_pkt_ring_get(struct smd_pkt_dev *smd_pkt_devp)
+{
+	struct smd_pkt_ring *ring;
+
+	spin_lock(&smd_pkt_devp->ring_lock);
+	ring = smd_pkt_devp->ring;
+	if (ring)
+		kref_get(&ring->ref);
+	spin_unlock(&smd_pkt_devp->ring_lock);
+
+	return ring;
+}
+
+/*
+ * Called with rx_lock held, moves complete packets starting with one of
+ * @pkt_size into free slots of the ring and publishes them.
+ */
+static int smd_pkt_ring_fill(struct smd_pkt_dev *smd_pkt_devp,
+			     struct smd_pkt_ring *ring, int pkt_size)
+{
+	struct smd_pkt_ring_hdr *hdr = ring->base;
+	unsigned int tail = ACCESS_ONCE(hdr->tail);
+	u32 *slot;
+	int r = 0;
+
+	/* The tail comes from userspace, don't let it make us overrun */
+	if (ring->head - tail > ring->nr_slots)
+		return -EINVAL;
+
+	while (ring->head - tail < ring->nr_slots) {
+		if (pkt_size > ring->slot_size - sizeof(*slot)) {
+			pr_err("%s: packet size %d too big for ring on"
+			       " smd_pkt_dev id:%d\n", __func__, pkt_size,
+				smd_pkt_devp->i);
+			r = -ETOOSMALL;
+			break;
+		}
+
+		slot = ring->base + SMD_PKT_RING_HDR_SIZE +
+			(ring->head & (ring->nr_slots - 1)) * ring->slot_size;
+		r = smd_read(smd_pkt_devp->ch, slot + 1, pkt_size);
+		if (r != pkt_size) {
+			pr_err("%s Error while reading %d\n", __func__, r);
+			r = r < 0 ? r : -EIO;
+			break;
+		}
+		*slot = pkt_size;
+		ring->head++;
+		r = 0;
+
+		pkt_size = smd_pkt_next_packet(smd_pkt_devp);
+		if (!pkt_size)
+			break;
+	}
+
+	/* Slots must be visible before the head that hands them out */
+	smp_wmb();
+	hdr->head = ring->head;
+
+	return r < 0 ? r : ring->head - tail;
+}
+
+static long smd_pkt_ring_wait(struct smd_pkt_dev *smd_pkt_devp)
+{
+	struct smd_pkt_ring *ring;
+	int pkt_size;
+	int r;
+
+	if (!smd_pkt_devp->ch)
+		return -EINVAL;
+	if (smd_pkt_devp->do_reset_notification)
+		return notify_reset(smd_pkt_devp);
+
+	ring = smd_pkt_ring_get(smd_pkt_devp);
+	if (!ring)
+		return -EINVAL;
+
+	pkt_size = smd_pkt_wait_packet(smd_pkt_devp);
+	if (pkt_size < 0) {
+		r = pkt_size;
+		goto put;
+	}
+
+	/*
+	 * Packets go into the ring whole, so one that doesn't fit a slot or
+	 * can never be in the fifo all at once would be waited for forever.
+	 */
+	if (pkt_size > ring->slot_size - sizeof(u32) ||
+	    pkt_size >= smd_total_fifo_size(smd_pkt_devp->ch)) {
+		pr_err("%s: packet size %d too big for ring on"
+		       " smd_pkt_dev id:%d\n", __func__, pkt_size,
+			smd_pkt_devp->i);
+		r = -ETOOSMALL;
+		goto out;
+	}
+
+	r = wait_event_interruptible(smd_pkt_devp->ch_read_wait_queue,
+			smd_read_avail(smd_pkt_devp->ch) >= pkt_size ||
+			smd_pkt_devp->has_reset);
+	if (r < 0)
+		goto out;
+
+	if (smd_pkt_devp->has_reset)
+		r = notify_reset(smd_pkt_devp);
+	else
+		r = smd_pkt_ring_fill(smd_pkt_devp, ring, pkt_size);
+out:
+	mutex_unlock(&smd_pkt_devp->rx_lock);
+
+	if (r >= 0)
+		smd_pkt_read_done(smd_pkt_devp);
+put:
+	kref_put(&ring->ref, smd_pkt_ring_free);
+	return r;
+}
+
+static int smd_pkt_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct smd_pkt_dev *smd_pkt_devp = file->private_data;
+	struct smd_pkt_ring *ring;
+	int r;
+
+	if (!smd_pkt_devp)
+		return -EINVAL;
+
+	/*
+	 * mmap_sem is held for write here and readers fault on their
+	 * buffers with rx_lock held, so don't take rx_lock.  The reference
+	 * taken becomes the one of the mapping.
+	 */
+	ring = smd_pkt_ring_get(smd_pkt_devp);
+	if (!ring)
+		return -EINVAL;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > ring->size) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	r = remap_vmalloc_range(vma, ring->base, 0);
+	if (r)
+		goto out;
+
+	vma->vm_private_data = ring;
+	vma->vm_ops = &smd_pkt_ring_vm_ops;
+	return 0;
+out:
+	kref_put(&ring->ref, smd_pkt_ring_free);
+	return r;
+}
+
 static unsigned int smd_pkt_poll(struct file *file, poll_table *wait)
 {
 	struct smd_pkt_dev *smd_pkt_devp;
@@ -916,6 +1342,7 @@ int smd_pkt_release(struct inode *inode, struct file *file)
 {
 	int r = 0;
 	struct smd_pkt_dev *smd_pkt_devp = file->private_data;
+	struct smd_pkt_ring *ring;
 
 	if (!smd_pkt_devp) {
 		pr_err("%s on a NULL device\n", __func__);
@@ -939,6 +1366,12 @@ int smd_pkt_release(struct inode *inode, struct file *file)
 		if (smd_pkt_devp->pil)
 			pil_put(smd_pkt_devp->pil);
 	}
+	spin_lock(&smd_pkt_devp->ring_lock);
+	ring = smd_pkt_devp->ring;
+	smd_pkt_devp->ring = NULL;
+	spin_unlock(&smd_pkt_devp->ring_lock);
+	if (ring)
+		kref_put(&ring->ref, smd_pkt_ring_free);
 	mutex_unlock(&smd_pkt_devp->tx_lock);
 	mutex_unlock(&smd_pkt_devp->rx_lock);
 	mutex_unlock(&smd_pkt_devp->ch_lock);
@@ -961,6 +1394,7 @@ static const struct file_operations smd_pkt_fops = {
 	.write = smd_pkt_write,
 	.poll = smd_pkt_poll,
 	.unlocked_ioctl = smd_pkt_ioctl,
+	.mmap = smd_pkt_mmap,
 };
 
 static int __init smd_pkt_init(void)
@@ -1008,6 +1442,7 @@ static int __init smd_pkt_init(void)
 		mutex_init(&smd_pkt_devp[i]->ch_lock);
 		mutex_init(&smd_pkt_devp[i]->rx_lock);
 		mutex_init(&smd_pkt_devp[i]->tx_lock);
+		spin_lock_init(&smd_pkt_devp[i]->ring_lock);
 
 		cdev_init(&smd_pkt_devp[i]->cdev, &smd_pkt_fops);
 		smd_pkt_devp[i]->cdev.owner = THIS_MODULE;
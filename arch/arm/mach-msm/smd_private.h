@@ -256,4 +256,6 @@ struct interrupt_stat {
 };
 extern struct interrupt_stat interrupt_stats[NUM_SMD_SUBSYSTEMS];
 
+int smd_coalesce_stats(char *buf, int max);
+
 #endif
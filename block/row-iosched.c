@@ -99,16 +99,88 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 5
 
+/*
+ * Adaptive idling: a process is idled for only if it is not seeky and its
+ * mean think time, learned once it has issued enough READs, is below
+ * idle_time_ms. The idling duration then follows its think time.
+ */
+#define ROW_SEEK_THR		(sector_t)(8 * 100)
+#define ROW_RIC_SEEKY(ric)	(hweight32((ric)->seek_history) > 32/8)
+#define ROW_TTIME_VALID(ric)	((ric)->ttime_samples > 80)
+#define ROW_MIN_IDLE_USEC	500
+
+/*
+ * Default target completion latencies of the READ queue of each priority
+ * class, used when the latency target mode is enabled (in msec)
+ */
+#define ROW_HP_LAT_TARGET_MSEC	10
+#define ROW_RP_LAT_TARGET_MSEC	50
+#define ROW_LP_LAT_TARGET_MSEC	500
+
+/* Number of READ completions of a class between two quanta adjustments */
+#define ROW_LAT_ADJUST_INTERVAL		16
+/* The READ quantum may grow up to this factor of its default value */
+#define ROW_LAT_MAX_READ_FACTOR		8
+/* The WRITE quanta may grow up to this value */
+#define ROW_LAT_MAX_WRITE_QUANTUM	16
+
+/* Number of buckets in the completion latency histograms */
+#define ROW_LAT_BUCKETS	12
+
+/* Number of priority classes (HIGH, REGULAR, LOW) */
+#define ROW_NR_CLASSES	3
+
+/*
+ * Index of the first queue of each priority class. The first queue of
+ * each class is its READ queue.
+ */
+static const int row_class_idx[ROW_NR_CLASSES + 1] = {
+	ROWQ_HIGH_PRIO_IDX, ROWQ_REG_PRIO_IDX, ROWQ_LOW_PRIO_IDX, ROWQ_MAX_PRIO
+};
+
+/* Queue names, as used in the names of the sysfs attributes */
+static const char * const row_queue_name[] = {
+	"hp_read",		/* ROWQ_PRIO_HIGH_READ */
+	"hp_swrite",		/* ROWQ_PRIO_HIGH_SWRITE */
+	"rp_read",		/* ROWQ_PRIO_REG_READ */
+	"rp_swrite",		/* ROWQ_PRIO_REG_SWRITE */
+	"rp_write",		/* ROWQ_PRIO_REG_WRITE */
+	"lp_read",		/* ROWQ_PRIO_LOW_READ */
+	"lp_swrite"		/* ROWQ_PRIO_LOW_SWRITE */
+};
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
  *			to the queue
  * @begin_idling:	flag indicating wether we should idle
+ * @idle_time_us:	idling duration for the process that inserted the
+ *			last request (usec)
  *
  */
 struct rowq_idling_data {
 	ktime_t			last_insert_time;
 	bool			begin_idling;
+	s64			idle_time_us;
+};
+
+/**
+ * struct rowq_lat_data - completion latency statistics of a queue
+ * @hist:		histogram of completion latencies. Bucket i > 0
+ *			counts requests that took [2^(i-1), 2^i) msec, bucket
+ *			0 those under 1 msec and the last bucket all the rest
+ * @avg_us:		moving average of the completion latency (usec)
+ * @max_us:		maximal completion latency (usec)
+ * @nr_completed:	number of completed requests
+ *
+ * The latency of a request is measured from its insertion to the
+ * scheduler until its completion by the driver.
+ */
+struct rowq_lat_data {
+	unsigned long		hist[ROW_LAT_BUCKETS];
+	u32			avg_us;
+	u32			max_us;
+	unsigned long		nr_completed;
 };
 
 /**
@@ -122,6 +194,7 @@ struct rowq_idling_data {
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
  * @idle_data:		data for idling on queues
+ * @lat_data:		completion latency statistics
  *
  */
 struct row_queue {
@@ -136,6 +209,8 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct rowq_lat_data	lat_data;
 };
 
 /**
@@ -146,11 +221,14 @@ struct row_queue {
  * @hr_timer:	idling timer
  * @idle_work:	the work to be scheduled when idling timer expires
  * @idling_queue_idx:	index of the queues we're idling on
+ * @adaptive:		flag indicating whether idling adapts to the think
+ *			time and seekiness of each process
  *
  */
 struct idling_data {
 	s64				idle_time_ms;
 	s64				freq_ms;
+	int				adaptive;
 
 	struct hrtimer			hr_timer;
 	struct work_struct		idle_work;
@@ -171,6 +249,22 @@ struct starvation_data {
 	int				starvation_counter;
 };
 
+/**
+ * struct latency_data - data for the latency target mode
+ * @enabled:		flag indicating whether the dispatch quanta are
+ *			adapted to the target latencies
+ * @target_ms:		target completion latency of the READ queue of
+ *			each priority class (msec)
+ * @nr_completed:	number of READ completions of each priority class
+ *			since its quanta were last adjusted
+ *
+ */
+struct latency_data {
+	int				enabled;
+	int				target_ms[ROW_NR_CLASSES];
+	unsigned int			nr_completed[ROW_NR_CLASSES];
+};
+
 /**
  * struct row_queue - Per block device rqueue structure
  * @dispatch_queue:	dispatch rqueue
@@ -187,6 +281,7 @@ struct starvation_data {
  * @reg_prio_starvation: starvation data for REGULAR priority queues
  * @low_prio_starvation: starvation data for LOW priority queues
  * @cycle_flags:	used for marking unserved queueus
+ * @lat_data:		data for the latency target mode
  *
  */
 struct row_data {
@@ -206,9 +301,44 @@ struct row_data {
 	struct starvation_data		low_prio_starvation;
 
 	unsigned int			cycle_flags;
+
+	struct latency_data		lat_data;
+};
+
+/**
+ * struct row_io_cq - per process (io_context) per queue data
+ * @icq:		the generic io_cq, must be first
+ * @last_end_us:	completion time of the last READ request (usec)
+ * @ttime_samples:	decaying number of think time samples (x256)
+ * @ttime_total:	decaying sum of think times (x256, usec)
+ * @ttime_mean:		mean think time (usec)
+ * @last_pos:		sector following the last READ request
+ * @seek_history:	one bit per READ request, set if it was a seek
+ *
+ * The think time of a process is the time from the completion of its
+ * last READ to the insertion of its next one.
+ */
+struct row_io_cq {
+	struct io_cq			icq;
+	s64				last_end_us;
+	unsigned long			ttime_samples;
+	u64				ttime_total;
+	unsigned long			ttime_mean;
+	sector_t			last_pos;
+	u32				seek_history;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elv.priv[0]))
+#define RQ_RIC(rq) \
+	((rq)->elv.icq ? container_of((rq)->elv.icq, struct row_io_cq, icq) \
+		       : NULL)
+/* Time the request was inserted to the scheduler (usec, truncated) */
+#define RQ_START_US(rq) ((u32)(unsigned long)((rq)->elv.priv[1]))
+
+static inline void row_rq_set_start(struct request *rq)
+{
+	rq->elv.priv[1] = (void *)(unsigned long)(u32)ktime_to_us(ktime_get());
+}
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -316,6 +446,166 @@ static inline bool row_low_req_pending(struct row_data *rd)
 	return false;
 }
 
+/*
+ * row_prio_class() - Return the index of the priority class of a queue
+ * @prio:	queue priority (enum row_queue_prio)
+ *
+ * Returns 0 for HIGH, 1 for REGULAR and 2 for LOW priority queues.
+ */
+static inline int row_prio_class(enum row_queue_prio prio)
+{
+	if (prio < ROWQ_REG_PRIO_IDX)
+		return 0;
+	if (prio < ROWQ_LOW_PRIO_IDX)
+		return 1;
+	return 2;
+}
+
+/*
+ * row_adjust_quanta() - Adapt the quanta of a priority class to its
+ *			 target latency
+ * @rd:		pointer to struct row_data
+ * @rqueue:	the READ queue of the class
+ *
+ * While the average latency of the READ queue is above the target, the
+ * WRITE quanta of the class are halved back towards their defaults, and
+ * once there the READ quantum is increased. While it is below half the
+ * target, the READ quantum is decreased back to its default, and once
+ * there the WRITE queues get one more request per dispatch cycle. This
+ * keeps the READs under the target while giving the WRITEs all the
+ * bandwidth that is left.
+ */
+static void row_adjust_quanta(struct row_data *rd, struct row_queue *rqueue)
+{
+	int class = row_prio_class(rqueue->prio);
+	int start_idx = row_class_idx[class];
+	int end_idx = row_class_idx[class + 1];
+	u32 target_us = rd->lat_data.target_ms[class] * USEC_PER_MSEC;
+	int def_quantum = row_queues_def[rqueue->prio].quantum;
+	int step = max(rqueue->disp_quantum / 8, 1);
+	bool writes_boosted = false;
+	int i;
+
+	for (i = start_idx + 1; i < end_idx; i++)
+		if (rd->row_queues[i].disp_quantum >
+		    row_queues_def[i].quantum)
+			writes_boosted = true;
+
+	if (rqueue->lat_data.avg_us > target_us) {
+		if (writes_boosted) {
+			for (i = start_idx + 1; i < end_idx; i++)
+				rd->row_queues[i].disp_quantum =
+					max(rd->row_queues[i].disp_quantum / 2,
+					    row_queues_def[i].quantum);
+		} else if (rqueue->disp_quantum <
+			   def_quantum * ROW_LAT_MAX_READ_FACTOR) {
+			rqueue->disp_quantum = min(rqueue->disp_quantum + step,
+				def_quantum * ROW_LAT_MAX_READ_FACTOR);
+		}
+	} else if (rqueue->lat_data.avg_us < target_us / 2) {
+		if (rqueue->disp_quantum > def_quantum) {
+			rqueue->disp_quantum = max(rqueue->disp_quantum - step,
+						   def_quantum);
+		} else {
+			for (i = start_idx + 1; i < end_idx; i++)
+				if (rd->row_queues[i].disp_quantum <
+				    ROW_LAT_MAX_WRITE_QUANTUM)
+					rd->row_queues[i].disp_quantum++;
+		}
+	}
+
+	row_log_rowq(rd, rqueue->prio,
+		"avg latency %uus (target %uus), quantum %d",
+		rqueue->lat_data.avg_us, target_us, rqueue->disp_quantum);
+}
+
+/*
+ * row_update_latency() - Account the completion latency of a request
+ * @rd:		pointer to struct row_data
+ * @rqueue:	the queue the request was dispatched from
+ * @rq:		the completed request
+ *
+ */
+static void row_update_latency(struct row_data *rd, struct row_queue *rqueue,
+			       struct request *rq)
+{
+	struct rowq_lat_data *lat = &rqueue->lat_data;
+	u32 lat_us = (u32)ktime_to_us(ktime_get()) - RQ_START_US(rq);
+	u32 lat_ms = lat_us / USEC_PER_MSEC;
+	int bucket = lat_ms ? fls(lat_ms) : 0;
+	int class = row_prio_class(rqueue->prio);
+
+	lat->hist[min(bucket, ROW_LAT_BUCKETS - 1)]++;
+	lat->nr_completed++;
+	lat->max_us = max(lat->max_us, lat_us);
+	/* avg = 7/8 avg + 1/8 latency */
+	if (lat->avg_us)
+		lat->avg_us = lat->avg_us - (lat->avg_us >> 3) + (lat_us >> 3);
+	else
+		lat->avg_us = lat_us;
+
+	if (!rd->lat_data.enabled || rqueue->prio != row_class_idx[class])
+		return;
+
+	if (++rd->lat_data.nr_completed[class] >= ROW_LAT_ADJUST_INTERVAL) {
+		rd->lat_data.nr_completed[class] = 0;
+		row_adjust_quanta(rd, rqueue);
+	}
+}
+
+/*
+ * row_update_ttime() - Account the think time of a process inserting a READ
+ * @rd:		pointer to struct row_data
+ * @ric:	the process data
+ * @rq:		the inserted request
+ *
+ */
+static void row_update_ttime(struct row_data *rd, struct row_io_cq *ric,
+			     struct request *rq)
+{
+	s64 max_us = 2 * rd->rd_idle_data.idle_time_ms * USEC_PER_MSEC;
+	s64 elapsed;
+	sector_t sdist = 0;
+
+	if (ric->last_end_us) {
+		elapsed = ktime_to_us(ktime_get()) - ric->last_end_us;
+		elapsed = clamp_t(s64, elapsed, 0, max_us);
+
+		ric->ttime_samples = (7 * ric->ttime_samples + 256) / 8;
+		ric->ttime_total = (7 * ric->ttime_total + 256 * elapsed) / 8;
+		ric->ttime_mean = div_u64(ric->ttime_total + 128,
+					  ric->ttime_samples);
+	}
+
+	if (ric->last_pos) {
+		if (ric->last_pos < blk_rq_pos(rq))
+			sdist = blk_rq_pos(rq) - ric->last_pos;
+		else
+			sdist = ric->last_pos - blk_rq_pos(rq);
+	}
+	ric->seek_history <<= 1;
+	ric->seek_history |= (sdist > ROW_SEEK_THR);
+	ric->last_pos = blk_rq_pos(rq) + blk_rq_sectors(rq);
+}
+
+/*
+ * row_adaptive_idle_time() - Return how long to idle for a process
+ * @rd:		pointer to struct row_data
+ * @ric:	the process data
+ *
+ * Returns 0 if the process seeks or thinks too long for idling to pay
+ * off. Otherwise, twice its mean think time, bounded by idle_time_ms.
+ */
+static s64 row_adaptive_idle_time(struct row_data *rd, struct row_io_cq *ric)
+{
+	s64 max_us = rd->rd_idle_data.idle_time_ms * USEC_PER_MSEC;
+
+	if (ROW_RIC_SEEKY(ric) || ric->ttime_mean > max_us)
+		return 0;
+
+	return clamp_t(s64, 2 * ric->ttime_mean, ROW_MIN_IDLE_USEC, max_us);
+}
+
 /******************* Elevator callback functions *********************/
 
 /*
@@ -329,6 +619,7 @@ static void row_add_request(struct request_queue *q,
 {
 	struct row_data *rd = (struct row_data *)q->elevator->elevator_data;
 	struct row_queue *rqueue = RQ_ROWQ(rq);
+	struct row_io_cq *ric = RQ_RIC(rq);
 	s64 diff_ms;
 	bool queue_was_empty = list_empty(&rqueue->fifo);
 	unsigned long bv_page_flags = 0;
@@ -340,6 +631,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	row_rq_set_start(rq);
 
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(1);
@@ -368,9 +660,26 @@ static void row_add_request(struct request_queue *q,
 			return;
 		}
 
-		if ((bv_page_flags & (1L << PG_readahead)) ||
+		if (rd->rd_idle_data.adaptive && ric)
+			row_update_ttime(rd, ric, rq);
+
+		if (rd->rd_idle_data.adaptive && ric &&
+		    (ROW_TTIME_VALID(ric) || ROW_RIC_SEEKY(ric))) {
+			rqueue->idle_data.idle_time_us =
+				row_adaptive_idle_time(rd, ric);
+			rqueue->idle_data.begin_idling =
+				rqueue->idle_data.idle_time_us > 0;
+			row_log_rowq(rd, rqueue->prio,
+				"%s idling (think %luus%s)",
+				rqueue->idle_data.begin_idling ?
+					"Enable" : "Disable",
+				ric->ttime_mean,
+				ROW_RIC_SEEKY(ric) ? ", seeky" : "");
+		} else if ((bv_page_flags & (1L << PG_readahead)) ||
 		    (diff_ms < rd->rd_idle_data.freq_ms)) {
 			rqueue->idle_data.begin_idling = true;
+			rqueue->idle_data.idle_time_us =
+				rd->rd_idle_data.idle_time_ms * USEC_PER_MSEC;
 			row_log_rowq(rd, rqueue->prio, "Enable idling");
 		} else {
 			rqueue->idle_data.begin_idling = false;
@@ -459,6 +768,11 @@ static int row_reinsert_req(struct request_queue *q,
 static void row_completed_req(struct request_queue *q, struct request *rq)
 {
 	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	struct row_io_cq *ric = RQ_RIC(rq);
+
+	if (ric && rqueue && row_queues_def[rqueue->prio].idling_enabled)
+		ric->last_end_us = ktime_to_us(ktime_get());
 
 	 if (rq->cmd_flags & REQ_URGENT) {
 		if (!rd->urgent_in_flight) {
@@ -472,6 +786,9 @@ static void row_completed_req(struct request_queue *q, struct request *rq)
 	row_log(q, "completed %s %s req.",
 		(rq->cmd_flags & REQ_URGENT ? "URGENT" : "regular"),
 		(rq_data_dir(rq) == READ ? "READ" : "WRITE"));
+
+	if (rqueue)
+		row_update_latency(rd, rqueue, rq);
 }
 
 /**
@@ -651,7 +968,8 @@ check_idling:
 
 initiate_idling:
 	hrtimer_start(&rd->rd_idle_data.hr_timer,
-		ktime_set(0, rd->rd_idle_data.idle_time_ms * NSEC_PER_MSEC),
+		ns_to_ktime(rd->row_queues[i].idle_data.idle_time_us *
+			    NSEC_PER_USEC),
 		HRTIMER_MODE_REL);
 
 	rd->rd_idle_data.idling_queue_idx = i;
@@ -809,12 +1127,19 @@ static void *row_init_queue(struct request_queue *q)
 		rdata->row_queues[i].idle_data.begin_idling = false;
 		rdata->row_queues[i].idle_data.last_insert_time =
 			ktime_set(0, 0);
+		rdata->row_queues[i].idle_data.idle_time_us =
+			ROW_IDLE_TIME_MSEC * USEC_PER_MSEC;
 	}
 
 	rdata->reg_prio_starvation.starvation_limit =
 			ROW_REG_STARVATION_TOLLERANCE;
 	rdata->low_prio_starvation.starvation_limit =
 			ROW_LOW_STARVATION_TOLLERANCE;
+
+	rdata->lat_data.enabled = 0;
+	rdata->lat_data.target_ms[0] = ROW_HP_LAT_TARGET_MSEC;
+	rdata->lat_data.target_ms[1] = ROW_RP_LAT_TARGET_MSEC;
+	rdata->lat_data.target_ms[2] = ROW_LP_LAT_TARGET_MSEC;
 	/*
 	 * Currently idling is enabled only for READ queues. If we want to
 	 * enable it for write queues also, note that idling frequency will
@@ -822,6 +1147,7 @@ static void *row_init_queue(struct request_queue *q)
 	 */
 	rdata->rd_idle_data.idle_time_ms = ROW_IDLE_TIME_MSEC;
 	rdata->rd_idle_data.freq_ms = ROW_READ_FREQ_MSEC;
+	rdata->rd_idle_data.adaptive = 1;
 	hrtimer_init(&rdata->rd_idle_data.hr_timer,
 		CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	rdata->rd_idle_data.hr_timer.function = &row_idle_hrtimer_fn;
@@ -987,10 +1313,15 @@ SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum);
 SHOW_FUNCTION(row_rd_idle_data_show, rowd->rd_idle_data.idle_time_ms);
 SHOW_FUNCTION(row_rd_idle_data_freq_show, rowd->rd_idle_data.freq_ms);
+SHOW_FUNCTION(row_rd_idle_adaptive_show, rowd->rd_idle_data.adaptive);
 SHOW_FUNCTION(row_reg_starv_limit_show,
 	rowd->reg_prio_starvation.starvation_limit);
 SHOW_FUNCTION(row_low_starv_limit_show,
 	rowd->low_prio_starvation.starvation_limit);
+SHOW_FUNCTION(row_latency_target_show, rowd->lat_data.enabled);
+SHOW_FUNCTION(row_hp_lat_target_show, rowd->lat_data.target_ms[0]);
+SHOW_FUNCTION(row_rp_lat_target_show, rowd->lat_data.target_ms[1]);
+SHOW_FUNCTION(row_lp_lat_target_show, rowd->lat_data.target_ms[2]);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)			\
@@ -1031,15 +1362,92 @@ STORE_FUNCTION(row_rd_idle_data_store, &rowd->rd_idle_data.idle_time_ms,
 			1, INT_MAX);
 STORE_FUNCTION(row_rd_idle_data_freq_store, &rowd->rd_idle_data.freq_ms,
 			1, INT_MAX);
+STORE_FUNCTION(row_rd_idle_adaptive_store, &rowd->rd_idle_data.adaptive,
+			0, 1);
 STORE_FUNCTION(row_reg_starv_limit_store,
 			&rowd->reg_prio_starvation.starvation_limit,
 			1, INT_MAX);
 STORE_FUNCTION(row_low_starv_limit_store,
 			&rowd->low_prio_starvation.starvation_limit,
 			1, INT_MAX);
+STORE_FUNCTION(row_hp_lat_target_store, &rowd->lat_data.target_ms[0],
+			1, INT_MAX / USEC_PER_MSEC);
+STORE_FUNCTION(row_rp_lat_target_store, &rowd->lat_data.target_ms[1],
+			1, INT_MAX / USEC_PER_MSEC);
+STORE_FUNCTION(row_lp_lat_target_store, &rowd->lat_data.target_ms[2],
+			1, INT_MAX / USEC_PER_MSEC);
 
 #undef STORE_FUNCTION
 
+/*
+ * Switching the latency target mode on or off restarts all queues from
+ * their default quanta.
+ */
+static ssize_t row_latency_target_store(struct elevator_queue *e,
+			const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int __data;
+	int ret = row_var_store(&__data, (page), count);
+	int i;
+
+	spin_lock_irq(q->queue_lock);
+	rowd->lat_data.enabled = !!__data;
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		rowd->row_queues[i].disp_quantum = row_queues_def[i].quantum;
+	for (i = 0; i < ROW_NR_CLASSES; i++)
+		rowd->lat_data.nr_completed[i] = 0;
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t row_latency_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	ssize_t ret;
+	int i, j;
+
+	ret = snprintf(page, PAGE_SIZE, "%-10s %8s %8s %8s", "queue",
+		       "avg_us", "max_us", "quantum");
+	for (j = 0; j < ROW_LAT_BUCKETS - 1; j++)
+		ret += snprintf(page + ret, PAGE_SIZE - ret, " <%ums", 1 << j);
+	ret += snprintf(page + ret, PAGE_SIZE - ret, " >=%ums\n",
+			1 << (ROW_LAT_BUCKETS - 2));
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		struct row_queue *rqueue = &rowd->row_queues[i];
+
+		ret += snprintf(page + ret, PAGE_SIZE - ret,
+				"%-10s %8u %8u %8d", row_queue_name[i], rqueue->lat_data.avg_us,
+				rqueue->lat_data.max_us, rqueue->disp_quantum);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			ret += snprintf(page + ret, PAGE_SIZE - ret, " %lu",
+					rqueue->lat_data.hist[j]);
+		ret += snprintf(page + ret, PAGE_SIZE - ret, "\n");
+	}
+
+	return ret;
+}
+
+/* Writing anything clears the latency statistics */
+static ssize_t row_latency_hist_store(struct elevator_queue *e,
+			const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int i;
+
+	spin_lock_irq(q->queue_lock);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		memset(&rowd->row_queues[i].lat_data, 0,
+		       sizeof(rowd->row_queues[i].lat_data));
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -1054,8 +1462,14 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(rd_idle_data),
 	ROW_ATTR(rd_idle_data_freq),
+	ROW_ATTR(rd_idle_adaptive),
 	ROW_ATTR(reg_starv_limit),
 	ROW_ATTR(low_starv_limit),
+	ROW_ATTR(latency_target),
+	ROW_ATTR(hp_lat_target),
+	ROW_ATTR(rp_lat_target),
+	ROW_ATTR(lp_lat_target),
+	ROW_ATTR(latency_hist),
 	__ATTR_NULL
 };
 
@@ -1073,8 +1487,8 @@ static struct elevator_type iosched_row = {
 		.elevator_init_fn		= row_init_queue,
 		.elevator_exit_fn		= row_exit_queue,
 	},
-	.icq_size = sizeof(struct io_cq),
-	.icq_align = __alignof__(struct io_cq),
+	.icq_size = sizeof(struct row_io_cq),
+	.icq_align = __alignof__(struct row_io_cq),
 	.elevator_attrs = row_attrs,
 	.elevator_name = "row",
 	.elevator_owner = THIS_MODULE,
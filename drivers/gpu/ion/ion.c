@@ -19,6 +19,7 @@
 #include <linux/device.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
 #include <linux/anon_inodes.h>
 #include <linux/ion.h>
 #include <linux/list.h>
@@ -46,6 +47,11 @@
  * @lock:		lock protecting the buffers & heaps trees
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
+ * @kmap_lock:		protects the kernel mapping cache below
+ * @kmap_lru:		buffers that keep their kernel mapping while nobody
+ *			uses it, least recently used first
+ * @kmap_cached:	bytes of kernel mappings on @kmap_lru
+ * @kmap_budget_kb:	limit for @kmap_cached, 0 disables the cache
  */
 struct ion_device {
 	struct miscdevice dev;
@@ -56,8 +62,22 @@ struct ion_device {
 			      unsigned long arg);
 	struct rb_root clients;
 	struct dentry *debug_root;
+	struct mutex kmap_lock;
+	struct list_head kmap_lru;
+	size_t kmap_cached;
+	u32 kmap_budget_kb;
+	unsigned long kmap_hits;
+	unsigned long kmap_misses;
+	unsigned long kmap_evictions;
 };
 
+/*
+ * Kernel mappings of idle buffers are kept up to this many kB of
+ * vmalloc space, so that clients mapping the same buffers over and over
+ * don't pay for a vmap and vunmap each time.
+ */
+#define ION_KMAP_CACHE_BUDGET_KB	(16 * 1024)
+
 /**
  * struct ion_client - a process/hw block local address space
  * @node:		node in the tree of all clients
@@ -207,6 +227,12 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	kref_init(&buffer->ref);
 
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	if (ret && (heap->flags & ION_HEAP_FLAG_DEFER_FREE)) {
+		/* memory may be sitting on the free list, get it back */
+		if (ion_heap_freelist_drain(heap, 0))
+			ret = heap->ops->allocate(heap, buffer, len, align,
+						  flags);
+	}
 	if (ret) {
 		kfree(buffer);
 		return ERR_PTR(ret);
@@ -225,6 +251,7 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	buffer->sg_table = table;
 
 	mutex_init(&buffer->lock);
+	INIT_LIST_HEAD(&buffer->kmap_lru);
 	ion_buffer_add(dev, buffer);
 	return buffer;
 }
@@ -261,21 +288,39 @@ static void ion_iommu_delayed_unmap(struct ion_buffer *buffer)
 	mutex_unlock(&buffer->lock);
 }
 
-static void ion_buffer_destroy(struct kref *kref)
-{
-	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
-	struct ion_device *dev = buffer->dev;
+/**
+ * Tear down the mappings of a buffer nobody can reach anymore and give
+ * its memory back to the heap.
+ */
+static void ion_buffer_kmap_uncache(struct ion_buffer *buffer);
 
+void ion_buffer_free(struct ion_buffer *buffer)
+{
+	ion_buffer_kmap_uncache(buffer);
 	if (WARN_ON(buffer->kmap_cnt > 0))
 		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
 
 	buffer->heap->ops->unmap_dma(buffer->heap, buffer);
 
 	ion_iommu_delayed_unmap(buffer);
+	buffer->heap->ops->free(buffer);
+	kfree(buffer);
+}
+
+static void ion_buffer_destroy(struct kref *kref)
+{
+	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
+	struct ion_device *dev = buffer->dev;
+	struct ion_heap *heap = buffer->heap;
+
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
 	mutex_unlock(&dev->lock);
-	kfree(buffer);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_add(heap, buffer);
+	else
+		ion_buffer_free(buffer);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -527,14 +572,95 @@ int ion_phys(struct ion_client *client, struct ion_handle *handle,
 }
 EXPORT_SYMBOL(ion_phys);
 
+/*
+ * A buffer with a kernel mapping but no kmap_cnt is on the device's
+ * kmap_lru.  Buffers are only taken off the list with dev->kmap_lock
+ * held, and only unmapped with their own lock held as well, except on
+ * the final free when nobody else can reach them.
+ */
+
+/* called with dev->kmap_lock held */
+static void ion_kmap_cache_evict(struct ion_device *dev, size_t budget)
+{
+	struct ion_buffer *buffer, *tmp;
+
+	list_for_each_entry_safe(buffer, tmp, &dev->kmap_lru, kmap_lru) {
+		if (dev->kmap_cached <= budget)
+			break;
+		/* a buffer being mapped right now is about to leave anyway */
+		if (!mutex_trylock(&buffer->lock))
+			continue;
+		list_del_init(&buffer->kmap_lru);
+		dev->kmap_cached -= buffer->size;
+		dev->kmap_evictions++;
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+		buffer->vaddr = NULL;
+		mutex_unlock(&buffer->lock);
+	}
+}
+
+/* called with buffer->lock held */
+static void ion_buffer_kmap_cache(struct ion_buffer *buffer)
+{
+	struct ion_device *dev = buffer->dev;
+	size_t budget;
+
+	mutex_lock(&dev->kmap_lock);
+	budget = (size_t)dev->kmap_budget_kb << 10;
+	if (!(buffer->heap->flags & ION_HEAP_FLAG_KMAP_CACHE) ||
+	    buffer->size > budget) {
+		mutex_unlock(&dev->kmap_lock);
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+		buffer->vaddr = NULL;
+		return;
+	}
+	list_add_tail(&buffer->kmap_lru, &dev->kmap_lru);
+	dev->kmap_cached += buffer->size;
+	ion_kmap_cache_evict(dev, budget);
+	mutex_unlock(&dev->kmap_lock);
+}
+
+static void ion_buffer_kmap_uncache(struct ion_buffer *buffer)
+{
+	struct ion_device *dev = buffer->dev;
+	int cached = 0;
+
+	mutex_lock(&dev->kmap_lock);
+	if (!list_empty(&buffer->kmap_lru)) {
+		list_del_init(&buffer->kmap_lru);
+		dev->kmap_cached -= buffer->size;
+		cached = 1;
+	}
+	mutex_unlock(&dev->kmap_lock);
+
+	if (cached) {
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+		buffer->vaddr = NULL;
+	}
+}
+
 static void *ion_buffer_kmap_get(struct ion_buffer *buffer)
 {
+	struct ion_device *dev = buffer->dev;
 	void *vaddr;
 
 	if (buffer->kmap_cnt) {
 		buffer->kmap_cnt++;
 		return buffer->vaddr;
 	}
+
+	mutex_lock(&dev->kmap_lock);
+	if (buffer->vaddr) {
+		list_del_init(&buffer->kmap_lru);
+		dev->kmap_cached -= buffer->size;
+		dev->kmap_hits++;
+		mutex_unlock(&dev->kmap_lock);
+		buffer->kmap_cnt++;
+		return buffer->vaddr;
+	}
+	dev->kmap_misses++;
+	mutex_unlock(&dev->kmap_lock);
+
 	vaddr = buffer->heap->ops->map_kernel(buffer->heap, buffer);
 	if (IS_ERR_OR_NULL(vaddr))
 		return vaddr;
@@ -562,10 +688,8 @@ static void *ion_handle_kmap_get(struct ion_handle *handle)
 static void ion_buffer_kmap_put(struct ion_buffer *buffer)
 {
 	buffer->kmap_cnt--;
-	if (!buffer->kmap_cnt) {
-		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
-		buffer->vaddr = NULL;
-	}
+	if (!buffer->kmap_cnt)
+		ion_buffer_kmap_cache(buffer);
 }
 
 static void ion_handle_kmap_put(struct ion_handle *handle)
@@ -1145,16 +1269,78 @@ static void ion_dma_buf_release(struct dma_buf *dmabuf)
 	ion_buffer_put(buffer);
 }
 
+static struct page *ion_buffer_page(struct ion_buffer *buffer,
+				    unsigned long pgoff)
+{
+	struct sg_table *table = buffer->sg_table;
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(table->sgl, sg, table->nents, i) {
+		unsigned long npages = sg->length >> PAGE_SHIFT;
+
+		if (pgoff < npages)
+			return nth_page(sg_page(sg), pgoff);
+		pgoff -= npages;
+	}
+	return NULL;
+}
+
+/*
+ * Heaps made of struct pages are mapped one page at a time, so that
+ * clients touching a few pages don't need the whole buffer in vmalloc
+ * space.  Other heaps rely on the mapping from begin_cpu_access.
+ */
 static void *ion_dma_buf_kmap(struct dma_buf *dmabuf, unsigned long offset)
 {
 	struct ion_buffer *buffer = dmabuf->priv;
-	return buffer->vaddr + offset;
+	struct page *page;
+
+	if (!(buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE))
+		return buffer->vaddr + offset * PAGE_SIZE;
+
+	page = ion_buffer_page(buffer, offset);
+	if (!page)
+		return NULL;
+	return kmap(page);
 }
 
 static void ion_dma_buf_kunmap(struct dma_buf *dmabuf, unsigned long offset,
 			       void *ptr)
 {
-	return;
+	struct ion_buffer *buffer = dmabuf->priv;
+	struct page *page;
+
+	if (!(buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE))
+		return;
+
+	page = ion_buffer_page(buffer, offset);
+	if (page)
+		kunmap(page);
+}
+
+static void *ion_dma_buf_kmap_atomic(struct dma_buf *dmabuf,
+				     unsigned long offset)
+{
+	struct ion_buffer *buffer = dmabuf->priv;
+	struct page *page;
+
+	if (!(buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE))
+		return buffer->vaddr + offset * PAGE_SIZE;
+
+	page = ion_buffer_page(buffer, offset);
+	if (!page)
+		return NULL;
+	return kmap_atomic(page);
+}
+
+static void ion_dma_buf_kunmap_atomic(struct dma_buf *dmabuf,
+				      unsigned long offset, void *ptr)
+{
+	struct ion_buffer *buffer = dmabuf->priv;
+
+	if (buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE)
+		kunmap_atomic(ptr);
 }
 
 static int ion_dma_buf_begin_cpu_access(struct dma_buf *dmabuf, size_t start,
@@ -1164,6 +1350,9 @@ static int ion_dma_buf_begin_cpu_access(struct dma_buf *dmabuf, size_t start,
 	struct ion_buffer *buffer = dmabuf->priv;
 	void *vaddr;
 
+	if (buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE)
+		return 0;
+
 	if (!buffer->heap->ops->map_kernel) {
 		pr_err("%s: map kernel is not implemented by this heap.\n",
 		       __func__);
@@ -1186,6 +1375,9 @@ static void ion_dma_buf_end_cpu_access(struct dma_buf *dmabuf, size_t start,
 {
 	struct ion_buffer *buffer = dmabuf->priv;
 
+	if (buffer->heap->flags & ION_HEAP_FLAG_KMAP_PAGE)
+		return;
+
 	mutex_lock(&buffer->lock);
 	ion_buffer_kmap_put(buffer);
 	mutex_unlock(&buffer->lock);
@@ -1198,8 +1390,8 @@ struct dma_buf_ops dma_buf_ops = {
 	.release = ion_dma_buf_release,
 	.begin_cpu_access = ion_dma_buf_begin_cpu_access,
 	.end_cpu_access = ion_dma_buf_end_cpu_access,
-	.kmap_atomic = ion_dma_buf_kmap,
-	.kunmap_atomic = ion_dma_buf_kunmap,
+	.kmap_atomic = ion_dma_buf_kmap_atomic,
+	.kunmap_atomic = ion_dma_buf_kunmap_atomic,
 	.kmap = ion_dma_buf_kmap,
 	.kunmap = ion_dma_buf_kunmap,
 };
@@ -1649,6 +1841,14 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	}
 	ion_heap_print_debug(s, heap);
 	mutex_unlock(&dev->lock);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		spin_lock(&heap->free_lock);
+		seq_printf(s, "deferred free: %zu bytes queued, %llu bytes total"
+			   " in %lu batches\n", heap->free_list_size,
+			   heap->deferred_bytes, heap->deferred_batches);
+		spin_unlock(&heap->free_lock);
+	}
 	return 0;
 }
 
@@ -1676,6 +1876,10 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 		       __func__);
 
 	heap->dev = dev;
+	if ((heap->flags & ION_HEAP_FLAG_DEFER_FREE) &&
+	    ion_heap_init_deferred_free(heap))
+		heap->flags &= ~ION_HEAP_FLAG_DEFER_FREE;
+
 	mutex_lock(&dev->lock);
 	while (*p) {
 		parent = *p;
@@ -1816,6 +2020,31 @@ static const struct file_operations debug_leak_fops = {
 	.release = single_release,
 };
 
+static int ion_debug_kmap_cache_show(struct seq_file *s, void *unused)
+{
+	struct ion_device *dev = s->private;
+
+	mutex_lock(&dev->kmap_lock);
+	seq_printf(s, "cached: %zu kB of %u kB\n", dev->kmap_cached >> 10,
+		   dev->kmap_budget_kb);
+	seq_printf(s, "hits: %lu misses: %lu evictions: %lu\n",
+		   dev->kmap_hits, dev->kmap_misses, dev->kmap_evictions);
+	mutex_unlock(&dev->kmap_lock);
+	return 0;
+}
+
+static int ion_debug_kmap_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ion_debug_kmap_cache_show, inode->i_private);
+}
+
+static const struct file_operations debug_kmap_cache_fops = {
+	.open = ion_debug_kmap_cache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 
 
 struct ion_device *ion_device_create(long (*custom_ioctl)
@@ -1849,8 +2078,15 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 	mutex_init(&idev->lock);
 	idev->heaps = RB_ROOT;
 	idev->clients = RB_ROOT;
+	mutex_init(&idev->kmap_lock);
+	INIT_LIST_HEAD(&idev->kmap_lru);
+	idev->kmap_budget_kb = ION_KMAP_CACHE_BUDGET_KB;
 	debugfs_create_file("check_leaked_fds", 0664, idev->debug_root, idev,
 			    &debug_leak_fops);
+	debugfs_create_file("kmap_cache", 0444, idev->debug_root, idev,
+			    &debug_kmap_cache_fops);
+	debugfs_create_u32("kmap_cache_budget_kb", 0644, idev->debug_root,
+			   &idev->kmap_budget_kb);
 	return idev;
 }
 
@@ -0,0 +1,186 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(page + i);
+}
+
+/*
+ * Freed pages are queued dirty and zeroed here, off the free path, so
+ * that allocations can usually take an already zeroed page.
+ */
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+
+	spin_lock(&pool->lock);
+	while (!list_empty(&pool->dirty_items)) {
+		page = list_first_entry(&pool->dirty_items, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		ion_page_pool_zero(pool, page);
+		cond_resched();
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->items);
+		pool->count++;
+	}
+	spin_unlock(&pool->lock);
+}
+
+/**
+ * ion_page_pool_alloc - get a zeroed page of the pool's order
+ *
+ * Takes a zeroed page from the pool if there is one, else zeroes a
+ * dirty one, else falls back to the buddy allocator.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	int dirty = 0;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->items)) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		pool->count--;
+	} else if (!list_empty(&pool->dirty_items)) {
+		page = list_first_entry(&pool->dirty_items, struct page, lru);
+		pool->dirty_count--;
+		dirty = 1;
+	}
+	if (page) {
+		list_del(&page->lru);
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	spin_unlock(&pool->lock);
+
+	if (!page)
+		return alloc_pages(pool->gfp_mask, pool->order);
+
+	if (dirty)
+		ion_page_pool_zero(pool, page);
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	schedule_work(&pool->zero_work);
+}
+
+/**
+ * ion_page_pool_shrink - give pages back to the buddy allocator
+ * @nr_to_scan:	number of order-0 pages to release, 0 to only count
+ *
+ * Dirty pages go first since they would still need zeroing.  Returns
+ * the number of order-0 pages left in the pool.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0, left;
+
+	spin_lock(&pool->lock);
+	while (freed < nr_to_scan) {
+		if (!list_empty(&pool->dirty_items)) {
+			page = list_first_entry(&pool->dirty_items,
+						struct page, lru);
+			pool->dirty_count--;
+		} else if (!list_empty(&pool->items)) {
+			page = list_first_entry(&pool->items, struct page, lru);
+			pool->count--;
+		} else {
+			break;
+		}
+		list_del(&page->lru);
+		pool->shrunk++;
+		spin_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+
+		spin_lock(&pool->lock);
+	}
+	left = (pool->count + pool->dirty_count) << pool->order;
+	spin_unlock(&pool->lock);
+
+	return left;
+}
+
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s)
+{
+	unsigned long hits, misses;
+
+	spin_lock(&pool->lock);
+	hits = pool->hits;
+	misses = pool->misses;
+	seq_printf(s, "order %2u pool: %d zeroed %d dirty (%lu kB), "
+		   "%lu hits %lu misses (%lu%% hit), %lu shrunk\n",
+		   pool->order, pool->count, pool->dirty_count,
+		   ((pool->count + pool->dirty_count) << pool->order) *
+		   (PAGE_SIZE / 1024),
+		   hits, misses,
+		   hits + misses ? hits * 100 / (hits + misses) : 0,
+		   pool->shrunk);
+	spin_unlock(&pool->lock);
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->items);
+	INIT_LIST_HEAD(&pool->dirty_items);
+	spin_lock_init(&pool->lock);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	cancel_work_sync(&pool->zero_work);
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
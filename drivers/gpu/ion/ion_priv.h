@@ -25,6 +25,9 @@
 #include <linux/ion.h>
 #include <linux/iommu.h>
 #include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 enum {
 	DI_PARTITION_NUM = 0,
@@ -81,6 +84,8 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sg_table:		the sg table for the buffer if dmap_cnt is not zero
+ * @list:		element in the heap's deferred free list
+ * @kmap_lru:		element in the device's cache of idle kernel mappings
 */
 struct ion_buffer {
 	struct kref ref;
@@ -102,8 +107,12 @@ struct ion_buffer {
 	unsigned int iommu_map_cnt;
 	struct rb_root iommu_maps;
 	int marked;
+	struct list_head list;
+	struct list_head kmap_lru;
 };
 
+void ion_buffer_free(struct ion_buffer *buffer);
+
 /**
  * struct ion_heap_ops - ops to operate on a given heap
  * @allocate:		allocate memory
@@ -160,6 +169,14 @@ struct ion_heap_ops {
  *			MUST be unique
  * @name:		used for debugging
  * @priv:		private heap data
+ * @flags:		flags, see ION_HEAP_FLAG_*
+ * @free_list:		buffers waiting to be freed by @task
+ * @free_list_size:	bytes queued on @free_list
+ * @free_lock:		protects @free_list and the deferred free counters
+ * @waitqueue:		@task waits here for buffers to be queued
+ * @task:		thread freeing deferred buffers
+ * @deferred_bytes:	total bytes ever queued for deferred freeing
+ * @deferred_batches:	number of batches taken off @free_list
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -174,8 +191,36 @@ struct ion_heap {
 	int id;
 	const char *name;
 	void *priv;
+	unsigned long flags;
+	struct list_head free_list;
+	size_t free_list_size;
+	spinlock_t free_lock;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
+	u64 deferred_bytes;
+	unsigned long deferred_batches;
 };
 
+/*
+ * Buffers of heaps with this flag are not freed by the last put, but
+ * queued to a low priority thread which frees them in batches.
+ */
+#define ION_HEAP_FLAG_DEFER_FREE	(1 << 0)
+
+/*
+ * Buffers of heaps with this flag are backed by struct pages in their
+ * sg_table, so dma_buf kmap can map them one page at a time.
+ */
+#define ION_HEAP_FLAG_KMAP_PAGE		(1 << 1)
+
+/*
+ * Kernel mappings of buffers of heaps with this flag are kept on the
+ * device's LRU once unused.  Heaps that track their mappings, like the
+ * content protection heaps that cannot be secured while any exist,
+ * must not set it.
+ */
+#define ION_HEAP_FLAG_KMAP_CACHE	(1 << 2)
+
 /**
  * struct mem_map_data - represents information about the memory map for a heap
  * @node:		rb node used to store in the tree of mem_map_data
@@ -229,6 +274,35 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
 void ion_heap_destroy(struct ion_heap *);
 
+/**
+ * ion_heap_init_deferred_free - start the deferred free thread of a heap
+ * @heap:		heap with ION_HEAP_FLAG_DEFER_FREE set
+ */
+int ion_heap_init_deferred_free(struct ion_heap *heap);
+
+/**
+ * ion_heap_freelist_add - queue a buffer to be freed by the heap's thread
+ * @heap:		the heap
+ * @buffer:		the buffer, no longer reachable from the device
+ */
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+
+/**
+ * ion_heap_freelist_drain - free queued buffers in the caller's context
+ * @heap:		the heap
+ * @size:		bytes to free, 0 to empty the list
+ *
+ * Returns the number of bytes freed.  Used to get memory back right
+ * away, e.g. from a shrinker or when an allocation fails.
+ */
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size);
+
+/**
+ * ion_heap_freelist_size - bytes currently queued for deferred freeing
+ * @heap:		the heap
+ */
+size_t ion_heap_freelist_size(struct ion_heap *heap);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *);
 void ion_system_heap_destroy(struct ion_heap *);
 
@@ -247,6 +321,45 @@ void ion_cp_heap_destroy(struct ion_heap *);
 struct ion_heap *ion_reusable_heap_create(struct ion_platform_heap *);
 void ion_reusable_heap_destroy(struct ion_heap *);
 
+/**
+ * struct ion_page_pool - pool of pages of one order
+ * @count:		number of zeroed pages ready to hand out
+ * @dirty_count:	number of freed pages waiting to be zeroed
+ * @items:		zeroed pages
+ * @dirty_items:	freed pages, zeroed in the background by @zero_work
+ * @lock:		protects the lists, counts and stats
+ * @zero_work:		zeroes dirty pages
+ * @gfp_mask:		gfp mask for pages taken from the buddy allocator
+ * @order:		order of the pages in the pool
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the buddy allocator
+ * @shrunk:		pages released to the buddy allocator by the shrinker
+ *
+ * Allows heaps that churn through buffers to recycle their pages
+ * instead of going through the buddy allocator and zeroing them on
+ * every allocation.  Pages are linked through page->lru.
+ */
+struct ion_page_pool {
+	int count;
+	int dirty_count;
+	struct list_head items;
+	struct list_head dirty_items;
+	spinlock_t lock;
+	struct work_struct zero_work;
+	gfp_t gfp_mask;
+	unsigned int order;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long shrunk;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s);
+
 /**
  * kernel api to allocate/free from carveout -- used when carveout is
  * used to back an architecture specific custom heap
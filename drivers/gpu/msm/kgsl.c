@@ -35,6 +35,7 @@
 #include "kgsl_cffdump.h"
 #include "kgsl_log.h"
 #include "kgsl_sharedmem.h"
+#include "kgsl_pool.h"
 #include "kgsl_device.h"
 #include "kgsl_trace.h"
 #include "kgsl_sync.h"
@@ -3478,11 +3479,16 @@ static void kgsl_core_exit(void)
 
 	kgsl_memfree_hist_exit();
 	unregister_chrdev_region(kgsl_driver.major, KGSL_DEVICE_MAX);
+	kgsl_pool_exit();
 }
 
 static int __init kgsl_core_init(void)
 {
 	int result = 0;
+
+	/* set up first, kgsl_core_exit() tears it down on any error */
+	kgsl_pool_init();
+
 	/* alloc major and minor device numbers */
 	result = alloc_chrdev_region(&kgsl_driver.major, 0, KGSL_DEVICE_MAX,
 				  KGSL_NAME);
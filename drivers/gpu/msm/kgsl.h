@@ -133,6 +133,7 @@ struct kgsl_driver {
 		unsigned int mapped;
 		unsigned int mapped_max;
 		unsigned int histogram[16];
+		unsigned int alloc_latency[16];
 	} stats;
 };
 
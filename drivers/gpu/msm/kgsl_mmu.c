@@ -14,7 +14,6 @@
 #include <linux/types.h>
 #include <linux/device.h>
 #include <linux/spinlock.h>
-#include <linux/genalloc.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/iommu.h>
@@ -25,6 +24,7 @@
 #include "kgsl_mmu.h"
 #include "kgsl_device.h"
 #include "kgsl_sharedmem.h"
+#include "kgsl_va.h"
 #include "adreno.h"
 
 static enum kgsl_mmutype kgsl_mmu_type;
@@ -98,10 +98,8 @@ static void kgsl_destroy_pagetable(struct kref *kref)
 
 	kgsl_cleanup_pt(pagetable);
 
-	if (pagetable->kgsl_pool)
-		gen_pool_destroy(pagetable->kgsl_pool);
-	if (pagetable->pool)
-		gen_pool_destroy(pagetable->pool);
+	kgsl_va_pool_destroy(pagetable->kgsl_pool);
+	kgsl_va_pool_destroy(pagetable->pool);
 
 	pagetable->pt_ops->mmu_destroy_pagetable(pagetable->priv);
 
@@ -476,33 +474,24 @@ static struct kgsl_pagetable *kgsl_mmu_createpagetableobject(
 	if ((KGSL_MMU_TYPE_IOMMU == kgsl_mmu_get_mmutype()) &&
 		((KGSL_MMU_GLOBAL_PT == name) ||
 		(KGSL_MMU_PRIV_BANK_TABLE_NAME == name))) {
-		pagetable->kgsl_pool = gen_pool_create(ilog2(SZ_8K), -1);
+		pagetable->kgsl_pool = kgsl_va_pool_create(ilog2(SZ_8K),
+					KGSL_IOMMU_GLOBAL_MEM_BASE,
+					KGSL_IOMMU_GLOBAL_MEM_SIZE);
 		if (pagetable->kgsl_pool == NULL) {
-			KGSL_CORE_ERR("gen_pool_create(%d) failed\n",
+			KGSL_CORE_ERR("kgsl_va_pool_create(%d) failed\n",
 					ilog2(SZ_8K));
 			goto err_alloc;
 		}
-		if (gen_pool_add(pagetable->kgsl_pool,
-			KGSL_IOMMU_GLOBAL_MEM_BASE,
-			KGSL_IOMMU_GLOBAL_MEM_SIZE, -1)) {
-			KGSL_CORE_ERR("gen_pool_add failed\n");
-			goto err_kgsl_pool;
-		}
 	}
 
-	pagetable->pool = gen_pool_create(PAGE_SHIFT, -1);
+	pagetable->pool = kgsl_va_pool_create(PAGE_SHIFT,
+					kgsl_mmu_get_base_addr(), ptsize);
 	if (pagetable->pool == NULL) {
-		KGSL_CORE_ERR("gen_pool_create(%d) failed\n",
+		KGSL_CORE_ERR("kgsl_va_pool_create(%d) failed\n",
 			      PAGE_SHIFT);
 		goto err_kgsl_pool;
 	}
 
-	if (gen_pool_add(pagetable->pool, kgsl_mmu_get_base_addr(),
-				ptsize, -1)) {
-		KGSL_CORE_ERR("gen_pool_add failed\n");
-		goto err_pool;
-	}
-
 	if (KGSL_MMU_TYPE_GPU == kgsl_mmu_type)
 		pagetable->pt_ops = &gpummu_pt_ops;
 	else if (KGSL_MMU_TYPE_IOMMU == kgsl_mmu_type)
@@ -528,10 +517,9 @@ static struct kgsl_pagetable *kgsl_mmu_createpagetableobject(
 err_mmu_create:
 	pagetable->pt_ops->mmu_destroy_pagetable(pagetable->priv);
 err_pool:
-	gen_pool_destroy(pagetable->pool);
+	kgsl_va_pool_destroy(pagetable->pool);
 err_kgsl_pool:
-	if (pagetable->kgsl_pool)
-		gen_pool_destroy(pagetable->kgsl_pool);
+	kgsl_va_pool_destroy(pagetable->kgsl_pool);
 err_alloc:
 	kfree(pagetable);
 
@@ -610,7 +598,7 @@ void kgsl_mh_start(struct kgsl_device *device)
 EXPORT_SYMBOL(kgsl_mh_start);
 
 /**
- * kgsl_mmu_get_gpuaddr - Assign a memdesc with a gpuadddr from the gen pool
+ * kgsl_mmu_get_gpuaddr - Assign a memdesc with a gpuadddr from the va pool
  * @pagetable - pagetable whose pool is to be used
  * @memdesc - memdesc to which gpuaddr is assigned
  *
@@ -620,7 +608,7 @@ int
 kgsl_mmu_get_gpuaddr(struct kgsl_pagetable *pagetable,
 			struct kgsl_memdesc *memdesc)
 {
-	struct gen_pool *pool = NULL;
+	struct kgsl_va_pool *pool = NULL;
 	int size;
 	int page_align = ilog2(PAGE_SIZE);
 
@@ -680,10 +668,9 @@ kgsl_mmu_get_gpuaddr(struct kgsl_pagetable *pagetable,
 		}
 	}
 	if (pool) {
-		memdesc->gpuaddr = gen_pool_alloc_aligned(pool, size,
-							  page_align);
+		memdesc->gpuaddr = kgsl_va_pool_alloc(pool, size, page_align);
 		if (memdesc->gpuaddr == 0) {
-			KGSL_CORE_ERR("gen_pool_alloc(%d) failed, pool: %s\n",
+			KGSL_CORE_ERR("kgsl_va_pool_alloc(%d) failed, pool: %s\n",
 					size,
 					(pool == pagetable->kgsl_pool) ?
 					"kgsl_pool" : "general_pool");
@@ -757,7 +744,7 @@ int
 kgsl_mmu_put_gpuaddr(struct kgsl_pagetable *pagetable,
 			struct kgsl_memdesc *memdesc)
 {
-	struct gen_pool *pool;
+	struct kgsl_va_pool *pool;
 	int size;
 
 	if (memdesc->size == 0 || memdesc->gpuaddr == 0)
@@ -780,7 +767,7 @@ kgsl_mmu_put_gpuaddr(struct kgsl_pagetable *pagetable,
 			pool = NULL;
 	}
 	if (pool)
-		gen_pool_free(pool, memdesc->gpuaddr, size);
+		kgsl_va_pool_free(pool, memdesc->gpuaddr, size);
 	/*
 	 * Don't clear the gpuaddr on global mappings because they
 	 * may be in use by other pagetables
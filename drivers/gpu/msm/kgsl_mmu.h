@@ -32,6 +32,7 @@
 #define KGSL_MMU_PRIV_BANK_TABLE_NAME 0xFFFFFFFF
 
 struct kgsl_device;
+struct kgsl_va_pool;
 
 #define GSL_PT_SUPER_PTE 8
 #define GSL_PT_PAGE_WV		0x00000001
@@ -100,8 +101,8 @@ struct kgsl_pagetable {
 	spinlock_t lock;
 	struct kref refcount;
 	unsigned int   max_entries;
-	struct gen_pool *pool;
-	struct gen_pool *kgsl_pool;
+	struct kgsl_va_pool *pool;
+	struct kgsl_va_pool *kgsl_pool;
 	struct list_head list;
 	unsigned int name;
 	struct kobject *kobj;
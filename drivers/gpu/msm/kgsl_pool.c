@@ -0,0 +1,346 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+
+#include "kgsl_pool.h"
+
+/*
+ * Pages handed to the GPU have to be zeroed and flushed out of the
+ * caches first, which is a large part of the cost of a page_alloc
+ * memdesc.  The pools below keep pages of the two chunk sizes used by
+ * _kgsl_sharedmem_page_alloc ready to go: freed pages are queued dirty
+ * and cleaned by a worker, which also tops each pool up to its reserve.
+ * A shrinker hands everything back when the system needs the memory.
+ */
+
+/**
+ * struct kgsl_page_pool - pool of pages of a single order
+ * @order: order of the pages in the pool
+ * @gfp_mask: flags used by the worker to refill the pool
+ * @reserve: number of clean pages the worker tries to keep around
+ * @max: number of pages above which freed pages go to the system
+ * @lock: protects the lists and counters
+ * @clean: zeroed and flushed pages, ready to be handed out
+ * @dirty: freed pages waiting for the worker to clean them
+ * @clean_count: number of pages on @clean
+ * @dirty_count: number of pages on @dirty
+ * @hits: allocations served from @clean
+ * @misses: allocations that found @clean empty
+ * @shrunk: pages released by the shrinker
+ */
+struct kgsl_page_pool {
+	unsigned int order;
+	gfp_t gfp_mask;
+	int reserve;
+	int max;
+	spinlock_t lock;
+	struct list_head clean;
+	struct list_head dirty;
+	int clean_count;
+	int dirty_count;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long shrunk;
+};
+
+#define KGSL_POOL_GFP_MASK (__GFP_HIGHMEM | __GFP_NORETRY | \
+			    __GFP_NO_KSWAPD | __GFP_NOWARN)
+
+static struct kgsl_page_pool kgsl_pools[] = {
+	{
+		.order = 0,
+		.gfp_mask = GFP_KERNEL | KGSL_POOL_GFP_MASK,
+		.reserve = 256,
+		.max = 2048,
+	},
+	{
+		.order = 4,
+		.gfp_mask = GFP_KERNEL | __GFP_COMP | KGSL_POOL_GFP_MASK,
+		.reserve = 8,
+		.max = 64,
+	},
+};
+
+static void kgsl_pool_work_fn(struct work_struct *work);
+static DECLARE_WORK(kgsl_pool_work, kgsl_pool_work_fn);
+
+static struct kgsl_page_pool *kgsl_pool_find(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		if (kgsl_pools[i].order == order)
+			return &kgsl_pools[i];
+
+	return NULL;
+}
+
+static void kgsl_pool_clean_page(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++) {
+		void *ptr = kmap_atomic(nth_page(page, i));
+
+		memset(ptr, 0, PAGE_SIZE);
+		dmac_flush_range(ptr, ptr + PAGE_SIZE);
+		kunmap_atomic(ptr);
+	}
+
+#ifdef CONFIG_OUTER_CACHE
+	outer_flush_range(page_to_phys(page),
+			  page_to_phys(page) + (PAGE_SIZE << order));
+#endif
+}
+
+static void kgsl_pool_add_clean(struct kgsl_page_pool *pool,
+				struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->clean);
+	pool->clean_count++;
+	spin_unlock(&pool->lock);
+}
+
+static void kgsl_pool_fill(struct kgsl_page_pool *pool)
+{
+	struct page *page;
+
+	/* Recycle what was freed first, then go to the page allocator */
+	spin_lock(&pool->lock);
+	while (!list_empty(&pool->dirty)) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		kgsl_pool_clean_page(page, pool->order);
+		kgsl_pool_add_clean(pool, page);
+		cond_resched();
+
+		spin_lock(&pool->lock);
+	}
+
+	while (pool->clean_count < pool->reserve) {
+		spin_unlock(&pool->lock);
+
+		page = alloc_pages(pool->gfp_mask, pool->order);
+		if (page == NULL)
+			return;
+
+		kgsl_pool_clean_page(page, pool->order);
+		kgsl_pool_add_clean(pool, page);
+		cond_resched();
+
+		spin_lock(&pool->lock);
+	}
+	spin_unlock(&pool->lock);
+}
+
+static void kgsl_pool_work_fn(struct work_struct *work)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		kgsl_pool_fill(&kgsl_pools[i]);
+}
+
+/**
+ * kgsl_pool_alloc_page() - Get a zeroed and flushed page from the pool
+ * @order: order of the page
+ *
+ * Return: the page, or NULL if the pool for @order is empty.  The caller
+ * then has to allocate and clean a page itself.
+ */
+struct page *kgsl_pool_alloc_page(unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+	struct page *page = NULL;
+	int refill;
+
+	if (pool == NULL)
+		return NULL;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->clean)) {
+		page = list_first_entry(&pool->clean, struct page, lru);
+		list_del(&page->lru);
+		pool->clean_count--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	refill = pool->clean_count < pool->reserve;
+	spin_unlock(&pool->lock);
+
+	if (refill)
+		schedule_work(&kgsl_pool_work);
+
+	return page;
+}
+
+/**
+ * kgsl_pool_free_page() - Give a page back to the pool
+ * @page: the page
+ * @order: order of the page
+ *
+ * The page is freed to the system if the pool is full.
+ */
+void kgsl_pool_free_page(struct page *page, unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+
+	if (pool == NULL)
+		goto free;
+
+	spin_lock(&pool->lock);
+	if (pool->clean_count + pool->dirty_count >= pool->max) {
+		spin_unlock(&pool->lock);
+		goto free;
+	}
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	schedule_work(&kgsl_pool_work);
+	return;
+free:
+	__free_pages(page, order);
+}
+
+/* Returns the number of order 0 pages freed */
+static int kgsl_pool_shrink(struct kgsl_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0;
+
+	spin_lock(&pool->lock);
+	while (freed < nr_to_scan) {
+		/* Dirty pages would still have to be cleaned, drop those first */
+		if (!list_empty(&pool->dirty)) {
+			page = list_first_entry(&pool->dirty, struct page, lru);
+			pool->dirty_count--;
+		} else if (!list_empty(&pool->clean)) {
+			page = list_first_entry(&pool->clean, struct page, lru);
+			pool->clean_count--;
+		} else {
+			break;
+		}
+		list_del(&page->lru);
+		pool->shrunk++;
+		spin_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+
+		spin_lock(&pool->lock);
+	}
+	spin_unlock(&pool->lock);
+
+	return freed;
+}
+
+static int kgsl_pool_size(void)
+{
+	int i, total = 0;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		spin_lock(&pool->lock);
+		total += (pool->clean_count + pool->dirty_count) << pool->order;
+		spin_unlock(&pool->lock);
+	}
+
+	return total;
+}
+
+static int kgsl_pool_shrinker_fn(struct shrinker *shrinker,
+				 struct shrink_control *sc)
+{
+	int i, nr_to_scan = sc->nr_to_scan;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools) && nr_to_scan > 0; i++)
+		nr_to_scan -= kgsl_pool_shrink(&kgsl_pools[i], nr_to_scan);
+
+	return kgsl_pool_size();
+}
+
+static struct shrinker kgsl_pool_shrinker = {
+	.shrink = kgsl_pool_shrinker_fn,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/**
+ * kgsl_pool_stats_show() - Print the state of the pools
+ * @buf: buffer to print to
+ * @len: size of @buf
+ *
+ * Return: the number of characters written
+ */
+int kgsl_pool_stats_show(char *buf, size_t len)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		spin_lock(&pool->lock);
+		ret += snprintf(buf + ret, len - ret,
+			"order %u: clean %d dirty %d reserve %d max %d "
+			"hits %lu misses %lu shrunk %lu\n",
+			pool->order, pool->clean_count, pool->dirty_count,
+			pool->reserve, pool->max, pool->hits, pool->misses,
+			pool->shrunk);
+		spin_unlock(&pool->lock);
+	}
+
+	return ret;
+}
+
+int kgsl_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		spin_lock_init(&pool->lock);
+		INIT_LIST_HEAD(&pool->clean);
+		INIT_LIST_HEAD(&pool->dirty);
+	}
+
+	register_shrinker(&kgsl_pool_shrinker);
+	schedule_work(&kgsl_pool_work);
+
+	return 0;
+}
+
+void kgsl_pool_exit(void)
+{
+	int i;
+
+	unregister_shrinker(&kgsl_pool_shrinker);
+	cancel_work_sync(&kgsl_pool_work);
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		kgsl_pool_shrink(&kgsl_pools[i], INT_MAX);
+}
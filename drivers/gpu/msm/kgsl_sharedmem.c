@@ -18,11 +18,13 @@
 #include <linux/slab.h>
 #include <linux/kmemleak.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 
 #include "kgsl.h"
 #include "kgsl_sharedmem.h"
 #include "kgsl_cffdump.h"
 #include "kgsl_device.h"
+#include "kgsl_pool.h"
 
 /* An attribute for showing per-process memory statistics */
 struct kgsl_mem_entry_attribute {
@@ -236,6 +238,32 @@ static int kgsl_drv_histogram_show(struct device *dev,
 	return len;
 }
 
+/*
+ * Bucket i counts page_alloc memdescs that took between 2^i and 2^(i+1)
+ * microseconds to allocate, the last bucket also counts anything slower
+ */
+static int kgsl_drv_alloc_latency_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	int len = 0;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len, "%d ",
+			kgsl_driver.stats.alloc_latency[i]);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static int kgsl_drv_page_pool_show(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	return kgsl_pool_stats_show(buf, PAGE_SIZE);
+}
+
 DEVICE_ATTR(vmalloc, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(vmalloc_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(page_alloc, 0444, kgsl_drv_memstat_show, NULL);
@@ -245,6 +273,8 @@ DEVICE_ATTR(coherent_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(histogram, 0444, kgsl_drv_histogram_show, NULL);
+DEVICE_ATTR(alloc_latency, 0444, kgsl_drv_alloc_latency_show, NULL);
+DEVICE_ATTR(page_pool, 0444, kgsl_drv_page_pool_show, NULL);
 
 static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_vmalloc,
@@ -256,6 +286,8 @@ static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_mapped,
 	&dev_attr_mapped_max,
 	&dev_attr_histogram,
+	&dev_attr_alloc_latency,
+	&dev_attr_page_pool,
 	NULL
 };
 
@@ -299,10 +331,29 @@ static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 	}
 }
 
+/* Operate on a list of pages, merging physically contiguous runs */
+static void outer_cache_range_op_pages(struct page **pages, int count, int op)
+{
+	int i, start = 0;
+
+	for (i = 1; i <= count; i++) {
+		if (i < count && page_to_phys(pages[i]) ==
+				page_to_phys(pages[i - 1]) + PAGE_SIZE)
+			continue;
+		_outer_cache_range_op(op, page_to_phys(pages[start]),
+				      (i - start) << PAGE_SHIFT);
+		start = i;
+	}
+}
+
 #else
 static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 {
 }
+
+static void outer_cache_range_op_pages(struct page **pages, int count, int op)
+{
+}
 #endif
 
 static int kgsl_page_alloc_vmfault(struct kgsl_memdesc *memdesc,
@@ -368,7 +419,7 @@ static void kgsl_page_alloc_free(struct kgsl_memdesc *memdesc)
 		for_each_sg(memdesc->sg, sg, sglen, i){
 			if (sg->length == 0)
 				break;
-			__free_pages(sg_page(sg), get_order(sg->length));
+			kgsl_pool_free_page(sg_page(sg), get_order(sg->length));
 		}
 }
 
@@ -536,6 +587,8 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	pgprot_t page_prot = pgprot_writecombine(PAGE_KERNEL);
 	void *ptr;
 	unsigned int align;
+	ktime_t start = ktime_get();
+	s64 usecs;
 
 	align = (memdesc->flags & KGSL_MEMALIGN_MASK) >> KGSL_MEMALIGN_SHIFT;
 
@@ -607,6 +660,14 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 		else
 			gfp_mask |= GFP_KERNEL;
 
+		/* Pooled pages are already clean and don't go through vmap */
+		page = kgsl_pool_alloc_page(get_order(page_size));
+		if (page != NULL) {
+			sg_set_page(&memdesc->sg[sglen++], page, page_size, 0);
+			len -= page_size;
+			continue;
+		}
+
 		page = alloc_pages(gfp_mask, get_order(page_size));
 
 		if (page == NULL) {
@@ -648,28 +709,31 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	 * microseconds at best.  The only downside is that there needs to be
 	 * enough temporary space in vmalloc to accomodate the map. This
 	 * shouldn't be a problem, but if it happens, fall back to a much slower
-	 * path
+	 * path.  Pages that came from the KGSL page pool were cleaned when they
+	 * went into the pool, so only the freshly allocated ones are in pages[].
 	 */
 
-	ptr = vmap(pages, pcount, VM_IOREMAP, page_prot);
-
-	if (ptr != NULL) {
-		memset(ptr, 0, memdesc->size);
-		dmac_flush_range(ptr, ptr + memdesc->size);
-		vunmap(ptr);
-	} else {
-		/* Very, very, very slow path */
-
-		for (j = 0; j < pcount; j++) {
-			ptr = kmap_atomic(pages[j]);
-			memset(ptr, 0, PAGE_SIZE);
-			dmac_flush_range(ptr, ptr + PAGE_SIZE);
-			kunmap_atomic(ptr);
+	if (pcount) {
+		ptr = vmap(pages, pcount, VM_IOREMAP, page_prot);
+
+		if (ptr != NULL) {
+			memset(ptr, 0, pcount << PAGE_SHIFT);
+			dmac_flush_range(ptr, ptr + (pcount << PAGE_SHIFT));
+			vunmap(ptr);
+		} else {
+			/* Very, very, very slow path */
+
+			for (j = 0; j < pcount; j++) {
+				ptr = kmap_atomic(pages[j]);
+				memset(ptr, 0, PAGE_SIZE);
+				dmac_flush_range(ptr, ptr + PAGE_SIZE);
+				kunmap_atomic(ptr);
+			}
 		}
-	}
 
-	outer_cache_range_op_sg(memdesc->sg, memdesc->sglen,
-				KGSL_CACHE_OP_FLUSH);
+		outer_cache_range_op_pages(pages, pcount,
+					   KGSL_CACHE_OP_FLUSH);
+	}
 
 	KGSL_STATS_ADD(size, kgsl_driver.stats.page_alloc,
 		kgsl_driver.stats.page_alloc_max);
@@ -679,6 +743,10 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	if (order < 16)
 		kgsl_driver.stats.histogram[order]++;
 
+	usecs = ktime_us_delta(ktime_get(), start);
+	kgsl_driver.stats.alloc_latency[usecs > 1 ?
+		min_t(int, ilog2(usecs), 15) : 0]++;
+
 done:
 	if ((memdesc->sglen_alloc * sizeof(struct page *)) > PAGE_SIZE)
 		vfree(pages);
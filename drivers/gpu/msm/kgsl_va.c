@@ -0,0 +1,389 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/bug.h>
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "kgsl_va.h"
+
+/*
+ * GPU virtual address allocator.
+ *
+ * Free ranges live in an rbtree sorted by address, augmented with the
+ * size of the largest free range below each node.  That finds the
+ * lowest free range of a given size in O(log n), which is all an
+ * unaligned allocation needs.  Aligned allocations keep walking the
+ * ranges big enough in address order, skipping the subtrees of smaller
+ * ones, until one fits once aligned, so that they land where gen_pool's
+ * first fit would put them.  That costs a step per range that is big
+ * enough but too misaligned, so up to O(n) on a fragmented pool.
+ * Being sorted by address, the tree also gives the neighbours to merge
+ * with on free.  Allocated ranges go in a second tree so that free never
+ * needs memory: the node of the allocation is either merged away or
+ * becomes the new free range.
+ *
+ * This file is also built in userspace by
+ * tools/testing/selftests/kgsl_va, keep it to the kernel API used below.
+ */
+
+struct kgsl_va_range {
+	struct rb_node node;
+	unsigned int start;
+	unsigned int size;
+	unsigned int max_free;
+};
+
+#define to_range(n) rb_entry(n, struct kgsl_va_range, node)
+
+static inline unsigned int _max_free(struct rb_node *node)
+{
+	return node ? to_range(node)->max_free : 0;
+}
+
+static void _augment_cb(struct rb_node *node, void *data)
+{
+	struct kgsl_va_range *range = to_range(node);
+	unsigned int max = range->size;
+
+	max = max(max, _max_free(node->rb_left));
+	max = max(max, _max_free(node->rb_right));
+	range->max_free = max;
+}
+
+static void _insert(struct rb_root *root, struct kgsl_va_range *range,
+		    int augment)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (range->start < to_range(parent)->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, root);
+	if (augment) {
+		range->max_free = range->size;
+		rb_augment_insert(&range->node, _augment_cb, NULL);
+	}
+}
+
+static void _erase_free(struct kgsl_va_pool *pool,
+			struct kgsl_va_range *range)
+{
+	struct rb_node *deepest = rb_augment_erase_begin(&range->node);
+
+	rb_erase(&range->node, &pool->free);
+	rb_augment_erase_end(deepest, _augment_cb, NULL);
+	pool->nr_free--;
+}
+
+/* Call after changing the size of a free range in place */
+static inline void _update_free(struct kgsl_va_range *range)
+{
+	rb_augment_insert(&range->node, _augment_cb, NULL);
+}
+
+/* Lowest free range of at least @size bytes in the subtree at @node */
+static struct rb_node *_first_free(struct rb_node *node, unsigned int size)
+{
+	while (node) {
+		if (_max_free(node->rb_left) >= size)
+			node = node->rb_left;
+		else if (to_range(node)->size >= size)
+			return node;
+		else if (_max_free(node->rb_right) >= size)
+			node = node->rb_right;
+		else
+			break;
+	}
+
+	return NULL;
+}
+
+/* Next free range after @node of at least @size bytes */
+static struct rb_node *_next_free(struct rb_node *node, unsigned int size)
+{
+	struct rb_node *parent;
+
+	for (;;) {
+		if (_max_free(node->rb_right) >= size)
+			return _first_free(node->rb_right, size);
+
+		/* Climb to the first ancestor @node is on the left of */
+		while ((parent = rb_parent(node)) && node == parent->rb_right)
+			node = parent;
+		if (parent == NULL)
+			return NULL;
+
+		node = parent;
+		if (to_range(node)->size >= size)
+			return node;
+	}
+}
+
+/* Returns the aligned start of @size bytes in @range, or 0 if they don't fit */
+static unsigned int _fit(struct kgsl_va_range *range, unsigned int size,
+			 unsigned int align)
+{
+	unsigned int start = ALIGN(range->start, align);
+
+	if (start < range->start || start - range->start > range->size ||
+	    range->size - (start - range->start) < size)
+		return 0;
+
+	return start;
+}
+
+/**
+ * kgsl_va_pool_alloc() - Allocate a range of GPU addresses
+ * @pool: the pool
+ * @size: number of bytes, rounded up to the pool granule
+ * @align_order: log2 of the required alignment
+ *
+ * Return: the start of the range, or 0 on failure
+ */
+unsigned int kgsl_va_pool_alloc(struct kgsl_va_pool *pool, unsigned int size,
+				int align_order)
+{
+	struct kgsl_va_range *range, *busy, *tail;
+	unsigned int granule = 1U << pool->order;
+	unsigned int align, start = 0;
+	unsigned int front, back;
+	struct rb_node *node;
+
+	if (size == 0 || size > pool->size)
+		return 0;
+
+	size = ALIGN(size, granule);
+	align = align_order > pool->order ? 1U << align_order : granule;
+
+	/* Allocations run with the process memory spinlock held */
+	busy = kmalloc(sizeof(*busy), GFP_ATOMIC);
+	tail = kmalloc(sizeof(*tail), GFP_ATOMIC);
+	if (busy == NULL || tail == NULL)
+		goto out;
+
+	spin_lock(&pool->lock);
+
+	/*
+	 * Take the lowest range the allocation fits in once aligned, like
+	 * the first fit of gen_pool did.  Preferring ranges big enough for
+	 * any alignment instead splits large ranges early and fails where
+	 * gen_pool would not.  Unaligned allocations fit the first range.
+	 */
+	node = _first_free(pool->free.rb_node, size);
+	for (; node; node = _next_free(node, size)) {
+		range = to_range(node);
+		start = _fit(range, size, align);
+		if (start)
+			break;
+	}
+
+	if (!start) {
+		spin_unlock(&pool->lock);
+		goto out;
+	}
+
+	front = start - range->start;
+	back = range->size - front - size;
+
+	if (front == 0 && back == 0) {
+		_erase_free(pool, range);
+		kfree(busy);
+		busy = range;
+	} else if (front == 0) {
+		range->start += size;
+		range->size = back;
+		_update_free(range);
+	} else {
+		range->size = front;
+		_update_free(range);
+		if (back) {
+			tail->start = start + size;
+			tail->size = back;
+			_insert(&pool->free, tail, 1);
+			pool->nr_free++;
+			tail = NULL;
+		}
+	}
+
+	busy->start = start;
+	busy->size = size;
+	_insert(&pool->busy, busy, 0);
+	busy = NULL;
+	pool->allocated += size;
+
+	spin_unlock(&pool->lock);
+out:
+	kfree(busy);
+	kfree(tail);
+	return start;
+}
+EXPORT_SYMBOL(kgsl_va_pool_alloc);
+
+/**
+ * kgsl_va_pool_free() - Give back a range from kgsl_va_pool_alloc()
+ * @pool: the pool
+ * @addr: start of the range
+ * @size: size passed to kgsl_va_pool_alloc()
+ */
+void kgsl_va_pool_free(struct kgsl_va_pool *pool, unsigned int addr,
+		       unsigned int size)
+{
+	struct kgsl_va_range *busy = NULL, *prev = NULL, *next = NULL;
+	struct rb_node *node;
+
+	spin_lock(&pool->lock);
+
+	node = pool->busy.rb_node;
+	while (node) {
+		if (addr < to_range(node)->start) {
+			node = node->rb_left;
+		} else if (addr > to_range(node)->start) {
+			node = node->rb_right;
+		} else {
+			busy = to_range(node);
+			break;
+		}
+	}
+
+	if (WARN(busy == NULL || busy->size != ALIGN(size, 1U << pool->order),
+		 "kgsl: bad free of gpuaddr 0x%08x size %u\n", addr, size)) {
+		spin_unlock(&pool->lock);
+		return;
+	}
+
+	rb_erase(&busy->node, &pool->busy);
+	pool->allocated -= busy->size;
+
+	/* Find the free ranges on either side */
+	node = pool->free.rb_node;
+	while (node) {
+		if (addr < to_range(node)->start) {
+			next = to_range(node);
+			node = node->rb_left;
+		} else {
+			prev = to_range(node);
+			node = node->rb_right;
+		}
+	}
+
+	if (prev && prev->start + prev->size != busy->start)
+		prev = NULL;
+	if (next && busy->start + busy->size != next->start)
+		next = NULL;
+
+	if (prev && next) {
+		prev->size += busy->size + next->size;
+		_erase_free(pool, next);
+		_update_free(prev);
+		kfree(next);
+		kfree(busy);
+	} else if (prev) {
+		prev->size += busy->size;
+		_update_free(prev);
+		kfree(busy);
+	} else if (next) {
+		next->start = busy->start;
+		next->size += busy->size;
+		_update_free(next);
+		kfree(busy);
+	} else {
+		_insert(&pool->free, busy, 1);
+		pool->nr_free++;
+	}
+
+	spin_unlock(&pool->lock);
+}
+EXPORT_SYMBOL(kgsl_va_pool_free);
+
+void kgsl_va_pool_stats(struct kgsl_va_pool *pool,
+			struct kgsl_va_stats *stats)
+{
+	spin_lock(&pool->lock);
+	stats->allocated = pool->allocated;
+	stats->free = pool->size - pool->allocated;
+	stats->largest_free = _max_free(pool->free.rb_node);
+	stats->nr_free = pool->nr_free;
+	spin_unlock(&pool->lock);
+}
+EXPORT_SYMBOL(kgsl_va_pool_stats);
+
+/**
+ * kgsl_va_pool_create() - Create a pool of GPU addresses
+ * @order: log2 of the allocation granule
+ * @base: first address of the pool
+ * @size: size of the pool in bytes
+ *
+ * Return: the pool, or NULL if out of memory
+ */
+struct kgsl_va_pool *kgsl_va_pool_create(int order, unsigned int base,
+					 unsigned int size)
+{
+	struct kgsl_va_pool *pool;
+	struct kgsl_va_range *range;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	range = kmalloc(sizeof(*range), GFP_KERNEL);
+	if (pool == NULL || range == NULL) {
+		kfree(pool);
+		kfree(range);
+		return NULL;
+	}
+
+	spin_lock_init(&pool->lock);
+	pool->free = RB_ROOT;
+	pool->busy = RB_ROOT;
+	pool->order = order;
+	pool->base = base;
+	pool->size = size & ~((1U << order) - 1);
+
+	range->start = base;
+	range->size = pool->size;
+	_insert(&pool->free, range, 1);
+	pool->nr_free = 1;
+
+	return pool;
+}
+EXPORT_SYMBOL(kgsl_va_pool_create);
+
+void kgsl_va_pool_destroy(struct kgsl_va_pool *pool)
+{
+	struct rb_node *node;
+
+	if (pool == NULL)
+		return;
+
+	WARN(pool->allocated, "kgsl: destroying pool with %u bytes in use\n",
+	     pool->allocated);
+
+	while ((node = rb_first(&pool->busy)) != NULL) {
+		rb_erase(node, &pool->busy);
+		kfree(to_range(node));
+	}
+	while ((node = rb_first(&pool->free)) != NULL) {
+		rb_erase(node, &pool->free);
+		kfree(to_range(node));
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL(kgsl_va_pool_destroy);
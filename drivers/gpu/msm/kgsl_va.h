@@ -0,0 +1,71 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __KGSL_VA_H
+#define __KGSL_VA_H
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+/**
+ * struct kgsl_va_pool - allocator for a range of GPU virtual addresses
+ * @lock: protects the trees and counters
+ * @free: free ranges sorted by address, each node also caches the size
+ * of the largest free range in its subtree
+ * @busy: allocated ranges sorted by address
+ * @base: first address managed by the pool
+ * @size: size of the managed range in bytes
+ * @order: log2 of the allocation granule
+ * @allocated: bytes currently allocated
+ * @nr_free: number of ranges in @free
+ *
+ * Free and unaligned allocation are O(log n) in the number of ranges,
+ * which is what matters once a pagetable holds thousands of small
+ * buffers.  Aligned allocation also walks the free ranges that are big
+ * enough but too misaligned below the one it takes, see kgsl_va.c.
+ */
+struct kgsl_va_pool {
+	spinlock_t lock;
+	struct rb_root free;
+	struct rb_root busy;
+	unsigned int base;
+	unsigned int size;
+	int order;
+	unsigned int allocated;
+	unsigned int nr_free;
+};
+
+/**
+ * struct kgsl_va_stats - snapshot of the state of a pool
+ * @allocated: bytes currently allocated
+ * @free: bytes currently free
+ * @largest_free: size of the largest free range
+ * @nr_free: number of free ranges
+ */
+struct kgsl_va_stats {
+	unsigned int allocated;
+	unsigned int free;
+	unsigned int largest_free;
+	unsigned int nr_free;
+};
+
+struct kgsl_va_pool *kgsl_va_pool_create(int order, unsigned int base,
+					 unsigned int size);
+void kgsl_va_pool_destroy(struct kgsl_va_pool *pool);
+unsigned int kgsl_va_pool_alloc(struct kgsl_va_pool *pool, unsigned int size,
+				int align_order);
+void kgsl_va_pool_free(struct kgsl_va_pool *pool, unsigned int addr,
+		       unsigned int size);
+void kgsl_va_pool_stats(struct kgsl_va_pool *pool,
+			struct kgsl_va_stats *stats);
+
+#endif /* __KGSL_VA_H */
@@ -27,14 +27,25 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 #include <asm/cacheflush.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/*
+ * Locking: each area has its own mutex, which protects everything in the
+ * area, its unpinned ranges included.  ashmem_lru_lock protects the LRU
+ * list and lru_count and nests inside the area mutexes.  The shrinker
+ * goes the other way round, from the LRU to the areas, so it only ever
+ * trylocks an area, and holds a reference to it to be able to unlock it.
+ */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN]; 
 	struct list_head unpinned_list;	 
@@ -42,6 +53,8 @@ struct ashmem_area {
 	size_t size;			 
 	unsigned long vm_start;		 
 	unsigned long prot_mask;	 
+	struct mutex mutex;		 
+	atomic_t refcount;		 
 };
 
 struct ashmem_range {
@@ -57,7 +70,24 @@ static LIST_HEAD(ashmem_lru_list);
 
 static unsigned long lru_count;
 
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+#define ASHMEM_LAT_BUCKETS	16
+
+/* Latency of pin or unpin, bucket i counts calls of [2^(i-1), 2^i) us */
+struct ashmem_lat_stats {
+	atomic_long_t count;
+	atomic64_t total_ns;
+	atomic_long_t hist[ASHMEM_LAT_BUCKETS];
+};
+
+static struct {
+	atomic_long_t purged_pages;
+	atomic_long_t purge_batches;
+	atomic_long_t busy_skips;
+	struct ashmem_lat_stats pin;
+	struct ashmem_lat_stats unpin;
+} ashmem_stats;
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -88,14 +118,29 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+static inline void ashmem_area_get(struct ashmem_area *asma)
+{
+	atomic_inc(&asma->refcount);
+}
+
+static void ashmem_area_put(struct ashmem_area *asma)
+{
+	if (atomic_dec_and_test(&asma->refcount))
+		kmem_cache_free(ashmem_area_cachep, asma);
 }
 
 static int range_alloc(struct ashmem_area *asma,
@@ -141,8 +186,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -165,6 +213,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	INIT_LIST_HEAD(&asma->unpinned_list);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
+	mutex_init(&asma->mutex);
+	atomic_set(&asma->refcount, 1);
 	file->private_data = asma;
 
 	return 0;
@@ -175,14 +225,14 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
-	kmem_cache_free(ashmem_area_cachep, asma);
+	ashmem_area_put(asma);
 
 	return 0;
 }
@@ -193,7 +243,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (asma->size == 0)
@@ -212,7 +262,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -221,7 +271,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -241,7 +291,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -257,7 +307,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(!asma->size)) {
@@ -301,13 +351,25 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
+ *
+ * 'nr_to_scan' is the number of pages to try to free.
+ *
+ * The least recently unpinned range is purged together with all the other
+ * unpinned ranges of its area, which are most likely parts of the same
+ * cache, under a single acquisition of the area lock.  Areas whose lock
+ * is busy are rotated to the tail of the LRU and skipped.
+ */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct ashmem_range *range, *next;
+	long nr_to_scan = sc->nr_to_scan;
+	unsigned long tries;
 
 	
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -315,24 +377,51 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	
-	if (!mutex_trylock(&ashmem_mutex)) {
-                return -1;
-	}
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	spin_lock(&ashmem_lru_lock);
+	tries = lru_count;
+	while (!list_empty(&ashmem_lru_list) && nr_to_scan > 0 && tries--) {
+		struct ashmem_area *asma;
+		struct inode *inode;
+		LIST_HEAD(batch);
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+		if (!mutex_trylock(&asma->mutex)) {
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			atomic_long_inc(&ashmem_stats.busy_skips);
+			continue;
+		}
+		ashmem_area_get(asma);
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+			if (!range_on_lru(range))
+				continue;
+			list_move_tail(&range->lru, &batch);
+			lru_count -= range_size(range);
+			nr_to_scan -= range_size(range);
+		}
+		spin_unlock(&ashmem_lru_lock);
+
+		inode = asma->file->f_dentry->d_inode;
+		list_for_each_entry_safe(range, next, &batch, lru) {
+			loff_t start = range->pgstart * PAGE_SIZE;
+			loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+			vmtruncate_range(inode, start, end);
+			range->purged = ASHMEM_WAS_PURGED;
+			list_del(&range->lru);
+			atomic_long_add(range_size(range),
+					&ashmem_stats.purged_pages);
+		}
+		atomic_long_inc(&ashmem_stats.purge_batches);
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		mutex_unlock(&asma->mutex);
+		ashmem_area_put(asma);
+
+		spin_lock(&ashmem_lru_lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
 
 	return lru_count;
 }
@@ -346,7 +435,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -361,7 +450,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -369,7 +458,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(asma->file)) {
@@ -383,7 +472,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -392,7 +481,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -405,7 +494,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -494,11 +583,24 @@ static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 	return ret;
 }
 
+static void ashmem_account_latency(struct ashmem_lat_stats *stats,
+				   ktime_t delta)
+{
+	s64 ns = ktime_to_ns(delta);
+	int bucket = fls(div_s64(ns, NSEC_PER_USEC));
+
+	atomic_long_inc(&stats->count);
+	atomic64_add(ns, &stats->total_ns);
+	atomic_long_inc(&stats->hist[min(bucket, ASHMEM_LAT_BUCKETS - 1)]);
+}
+
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 			    void __user *p)
 {
+	struct ashmem_lat_stats *stats = NULL;
 	struct ashmem_pin pin;
 	size_t pgstart, pgend;
+	ktime_t start;
 	int ret = -EINVAL;
 
 	if (unlikely(!asma->file))
@@ -523,21 +625,27 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	start = ktime_get();
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
 		ret = ashmem_pin(asma, pgstart, pgend);
+		stats = &ashmem_stats.pin;
 		break;
 	case ASHMEM_UNPIN:
 		ret = ashmem_unpin(asma, pgstart, pgend);
+		stats = &ashmem_stats.unpin;
 		break;
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_get_pin_status(asma, pgstart, pgend);
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+
+	if (stats)
+		ashmem_account_latency(stats, ktime_sub(ktime_get(), start));
 
 	return ret;
 }
@@ -648,10 +756,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -746,6 +856,48 @@ void put_ashmem_file(struct file *file)
 }
 EXPORT_SYMBOL(put_ashmem_file);
 
+static void ashmem_lat_stats_show(struct seq_file *m, const char *name,
+				  struct ashmem_lat_stats *stats)
+{
+	long count = atomic_long_read(&stats->count);
+	int i;
+
+	seq_printf(m, "%s: %ld calls, avg %lld ns\n", name, count,
+		   count ? div_s64(atomic64_read(&stats->total_ns), count) : 0);
+	seq_printf(m, "%s latency (us):", name);
+	for (i = 0; i < ASHMEM_LAT_BUCKETS; i++)
+		seq_printf(m, " <%d:%ld", 1 << i,
+			   atomic_long_read(&stats->hist[i]));
+	seq_putc(m, '\n');
+}
+
+static int ashmem_stats_show(struct seq_file *m, void *unused)
+{
+	seq_printf(m, "lru pages: %lu\n", lru_count);
+	seq_printf(m, "purged pages: %ld\n",
+		   atomic_long_read(&ashmem_stats.purged_pages));
+	seq_printf(m, "purge batches: %ld\n",
+		   atomic_long_read(&ashmem_stats.purge_batches));
+	seq_printf(m, "busy areas skipped: %ld\n",
+		   atomic_long_read(&ashmem_stats.busy_skips));
+	ashmem_lat_stats_show(m, "pin", &ashmem_stats.pin);
+	ashmem_lat_stats_show(m, "unpin", &ashmem_stats.unpin);
+
+	return 0;
+}
+
+static int ashmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_stats_show, NULL);
+}
+
+static const struct file_operations ashmem_stats_fops = {
+	.open = ashmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static const struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -757,6 +909,8 @@ static const struct file_operations ashmem_fops = {
 	.compat_ioctl = ashmem_ioctl,
 };
 
+static struct dentry *ashmem_debugfs;
+
 static struct miscdevice ashmem_misc = {
 	.minor = MISC_DYNAMIC_MINOR,
 	.name = "ashmem",
@@ -791,6 +945,9 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs = debugfs_create_file("ashmem_stats", 0444, NULL, NULL,
+					     &ashmem_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -800,6 +957,7 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove(ashmem_debugfs);
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);
@@ -32,12 +32,13 @@
 struct logger_log {
 	unsigned char		*buffer;
 	struct miscdevice	misc;	
-	wait_queue_head_t	wq;	
 	struct list_head	readers; 
-	struct mutex		mutex;	
+	spinlock_t		lock;	
 	size_t			w_off;	
 	size_t			head;	
 	size_t			size;	
+	unsigned int		w_seq;	/* number of entries ever written */
+	unsigned int		h_seq;	/* sequence number of the head entry */
 };
 
 struct logger_reader {
@@ -46,8 +47,22 @@ struct logger_reader {
 	size_t			r_off;	
 	bool			r_all;	
 	int			r_ver;	
+	struct mutex		mutex;	/* serializes read() on the reader */
+	unsigned int		overruns; /* times writers moved r_off */
+	unsigned int		r_seq;	/* sequence number of the entry at r_off */
+	bool			r_batch; /* read() returns as many entries as fit */
+	struct logger_watermark	wmark;	/* pending data to wake up for */
+	wait_queue_head_t	wq;	
 };
 
+/*
+ * Writers gather their entry from userspace into a staging buffer before
+ * taking log->lock, so that page faults and other writers' copies happen
+ * in parallel and the lock only covers the copy into the ring.  Entries
+ * up to this size are staged on the stack, bigger ones are kmalloc()ed.
+ */
+#define LOGGER_STAGE_ON_STACK	256
+
 size_t logger_offset(struct logger_log *log, size_t n)
 {
 	return n & (log->size-1);
@@ -118,24 +133,25 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 	return copy_to_user(buf, hdr, hdr_len);
 }
 
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
+/*
+ * Copies the entry at @off, whose header is @entry, to userspace.  This
+ * runs without log->lock, the caller has to check that no writer
+ * overwrote the entry meanwhile.
+ */
+static ssize_t do_read_log_to_user(struct logger_log *log, int ver,
+				   struct logger_entry *entry, size_t off,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
 
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
+	if (copy_header_to_user(ver, entry, buf))
 		return -EFAULT;
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	count -= get_user_hdr_len(ver);
+	buf += get_user_hdr_len(ver);
+	msg_start = logger_offset(log, off + sizeof(struct logger_entry));
 
 	len = min(count, log->size - msg_start);
 	if (copy_to_user(buf, log->buffer + msg_start, len))
@@ -145,15 +161,14 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
-
-	return count + get_user_hdr_len(reader->r_ver);
+	return count + get_user_hdr_len(ver);
 }
 
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static void skip_entries_by_uid(struct logger_log *log,
+		struct logger_reader *reader, uid_t euid)
 {
+	size_t off = reader->r_off;
+
 	while (off != log->w_off) {
 		struct logger_entry *entry;
 		struct logger_entry scratch;
@@ -162,13 +177,91 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 		entry = get_entry_header(log, off, &scratch);
 
 		if (entry->euid == euid)
-			return off;
+			break;
 
 		next_len = sizeof(struct logger_entry) + entry->len;
 		off = logger_offset(log, off + next_len);
+		reader->r_seq++;
 	}
 
-	return off;
+	reader->r_off = off;
+}
+
+/*
+ * A reader is ready once its watermark is reached, or as soon as there is
+ * anything to read if it has none.  Called with log->lock held.
+ */
+static bool logger_reader_ready(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	size_t bytes = logger_offset(log, log->w_off - reader->r_off);
+
+	if (!bytes)
+		return false;
+	if (!reader->wmark.bytes && !reader->wmark.entries)
+		return true;
+
+	return (reader->wmark.bytes && bytes >= reader->wmark.bytes) ||
+		(reader->wmark.entries &&
+		 log->w_seq - reader->r_seq >= reader->wmark.entries);
+}
+
+/*
+ * Reads the next entry to @buf.  Returns its size, 0 if there is none,
+ * -EINVAL if it does not fit in @count bytes or -EFAULT.
+ *
+ * The entry is copied to userspace without log->lock.  If a writer
+ * wrapped over it meanwhile, which moves the reader, the next one is read.
+ */
+static ssize_t logger_read_entry(struct logger_reader *reader,
+				 char __user *buf, size_t count)
+{
+	struct logger_log *log = reader->log;
+	struct logger_entry scratch, header;
+	unsigned int overruns;
+	size_t r_off;
+	ssize_t ret;
+	int ver;
+
+retry:
+	spin_lock(&log->lock);
+
+	if (!reader->r_all)
+		skip_entries_by_uid(log, reader, current_euid());
+
+	if (log->w_off == reader->r_off) {
+		spin_unlock(&log->lock);
+		return 0;
+	}
+
+	/* The version can change once unlocked, size and copy with one */
+	ver = reader->r_ver;
+	header = *get_entry_header(log, reader->r_off, &scratch);
+	ret = get_user_hdr_len(ver) + header.len;
+	if (count < ret) {
+		spin_unlock(&log->lock);
+		return -EINVAL;
+	}
+
+	r_off = reader->r_off;
+	overruns = reader->overruns;
+	spin_unlock(&log->lock);
+
+	ret = do_read_log_to_user(log, ver, &header, r_off, buf, ret);
+	if (ret < 0)
+		return ret;
+
+	spin_lock(&log->lock);
+	if (unlikely(reader->overruns != overruns)) {
+		spin_unlock(&log->lock);
+		goto retry;
+	}
+	reader->r_off = logger_offset(log, r_off +
+		sizeof(struct logger_entry) + header.len);
+	reader->r_seq++;
+	spin_unlock(&log->lock);
+
+	return ret;
 }
 
 /*
@@ -177,8 +270,10 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
  * Behavior:
  *
  *	- O_NONBLOCK works
- *	- If there are no log entries to read, blocks until log is written to
- *	- Atomically reads exactly one log entry
+ *	- If there are no log entries to read, blocks until log is written to,
+ *	  or until the reader's watermark is reached if it set one
+ *	- Atomically reads exactly one log entry, or in batch mode as many
+ *	  whole entries as fit in the buffer
  *
  * Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -188,19 +283,30 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
-	ssize_t ret;
+	ssize_t ret, done;
+	bool ready;
 	DEFINE_WAIT(wait);
 
-start:
+	mutex_lock(&reader->mutex);
 	while (1) {
-		mutex_lock(&log->mutex);
+		prepare_to_wait(&reader->wq, &wait, TASK_INTERRUPTIBLE);
 
-		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
-
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
-			break;
+		spin_lock(&log->lock);
+		if (file->f_flags & O_NONBLOCK)
+			ready = (log->w_off != reader->r_off);
+		else
+			ready = logger_reader_ready(log, reader);
+		spin_unlock(&log->lock);
+
+		if (ready) {
+			__set_current_state(TASK_RUNNING);
+			ret = logger_read_entry(reader, buf, count);
+			/* 0 if all there was belonged to other users */
+			if (ret)
+				break;
+			if (!(file->f_flags & O_NONBLOCK))
+				continue;
+		}
 
 		if (file->f_flags & O_NONBLOCK) {
 			ret = -EAGAIN;
@@ -214,41 +320,25 @@ start:
 
 		schedule();
 	}
+	finish_wait(&reader->wq, &wait);
 
-	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
-
-	
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+	/* In batch mode, an error past the first entry just ends the batch */
+	done = ret;
+	while (reader->r_batch && done > 0 && done < count) {
+		ret = logger_read_entry(reader, buf + done, count - done);
+		if (ret <= 0)
+			break;
+		done += ret;
 	}
+	ret = done;
 
-	
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static size_t get_next_entry(struct logger_log *log, size_t off, size_t len,
+			     unsigned int *seq)
 {
 	size_t count = 0;
 
@@ -257,6 +347,7 @@ static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 			get_entry_msg_len(log, off);
 		off = logger_offset(log, off + nr);
 		count += nr;
+		(*seq)++;
 	} while (count < len);
 
 	return off;
@@ -284,50 +375,47 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	struct logger_reader *reader;
 
 	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+		log->head = get_next_entry(log, log->head, len, &log->h_seq);
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+		if (is_between(old, new, reader->r_off)) {
+			reader->r_off = get_next_entry(log, reader->r_off, len,
+						       &reader->r_seq);
+			reader->overruns++;
+		}
 }
 
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+/* Wakes up the readers whose watermark is reached, with log->lock held */
+static void wake_up_readers(struct logger_log *log)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
+	struct logger_reader *reader;
 
+	list_for_each_entry(reader, &log->readers, list)
+		if (waitqueue_active(&reader->wq) &&
+		    logger_reader_ready(log, reader))
+			wake_up_interruptible(&reader->wq);
 }
 
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
 	size_t len;
 
 	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	memcpy(log->buffer + log->w_off, buf, len);
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+		memcpy(log->buffer, buf + len, count - len);
 
 	log->w_off = logger_offset(log, log->w_off + count);
 
-	return count;
 }
 
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stage[LOGGER_STAGE_ON_STACK];
+	unsigned char *msg = stage;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
@@ -346,35 +434,43 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len > sizeof(stage)) {
+		msg = kmalloc(header.len, GFP_KERNEL);
+		if (!msg)
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
-		ssize_t nr;
 
 		
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (copy_from_user(msg + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
+	header.len = ret;
 
-	mutex_unlock(&log->mutex);
+	spin_lock(&log->lock);
 
-	
-	wake_up_interruptible(&log->wq);
+	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+
+	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, msg, header.len);
+	log->w_seq++;
+
+	wake_up_readers(log);
+
+	spin_unlock(&log->lock);
+
+out:
+	if (msg != stage)
+		kfree(msg);
 
 	return ret;
 }
@@ -405,13 +501,20 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
+		reader->overruns = 0;
+		reader->r_batch = false;
+		reader->wmark.bytes = 0;
+		reader->wmark.entries = 0;
+		mutex_init(&reader->mutex);
+		init_waitqueue_head(&reader->wq);
 
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
+		reader->r_seq = log->h_seq;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -426,9 +529,9 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		kfree(reader);
 	}
@@ -448,16 +551,15 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	reader = file->private_data;
 	log = reader->log;
 
-	poll_wait(file, &log->wq, wait);
+	poll_wait(file, &reader->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+		skip_entries_by_uid(log, reader, current_euid());
 
-	if (log->w_off != reader->r_off)
+	if (logger_reader_ready(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -471,7 +573,45 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	if ((version < 1) || (version > 2))
 		return -EINVAL;
 
+	spin_lock(&reader->log->lock);
 	reader->r_ver = version;
+	spin_unlock(&reader->log->lock);
+	return 0;
+}
+
+static long logger_set_read_mode(struct logger_reader *reader,
+				 void __user *arg)
+{
+	int mode;
+	if (copy_from_user(&mode, arg, sizeof(int)))
+		return -EFAULT;
+
+	if ((mode != LOGGER_READ_SINGLE) && (mode != LOGGER_READ_BATCH))
+		return -EINVAL;
+
+	reader->r_batch = (mode == LOGGER_READ_BATCH);
+	return 0;
+}
+
+static long logger_set_watermark(struct logger_reader *reader,
+				 void __user *arg)
+{
+	struct logger_log *log = reader->log;
+	struct logger_watermark wmark;
+
+	if (copy_from_user(&wmark, arg, sizeof(wmark)))
+		return -EFAULT;
+
+	/* Less than the whole log is ever pending, so this is never reached */
+	if (wmark.bytes >= log->size)
+		return -EINVAL;
+
+	spin_lock(&log->lock);
+	reader->wmark = wmark;
+	spin_unlock(&log->lock);
+
+	/* Let a blocked read or poll check against the new watermark */
+	wake_up_interruptible(&reader->wq);
 	return 0;
 }
 
@@ -482,7 +622,22 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	/* These copy from userspace, so they are done without log->lock */
+	switch (cmd) {
+	case LOGGER_SET_VERSION:
+	case LOGGER_SET_READ_MODE:
+	case LOGGER_SET_WATERMARK:
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		reader = file->private_data;
+		if (cmd == LOGGER_SET_VERSION)
+			return logger_set_version(reader, argp);
+		if (cmd == LOGGER_SET_READ_MODE)
+			return logger_set_read_mode(reader, argp);
+		return logger_set_watermark(reader, argp);
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -507,8 +662,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 
 		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
+			skip_entries_by_uid(log, reader, current_euid());
 
 		if (log->w_off != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
@@ -521,9 +675,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
+		list_for_each_entry(reader, &log->readers, list) {
 			reader->r_off = log->w_off;
+			reader->r_seq = log->w_seq;
+			reader->overruns++;
+		}
 		log->head = log->w_off;
+		log->h_seq = log->w_seq;
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -534,17 +692,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
-	case LOGGER_SET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
-			ret = -EBADF;
-			break;
-		}
-		reader = file->private_data;
-		ret = logger_set_version(reader, argp);
-		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -570,9 +720,8 @@ static struct logger_log VAR = { \
 		.fops = &logger_fops, \
 		.parent = NULL, \
 	}, \
-	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
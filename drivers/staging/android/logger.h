@@ -56,5 +56,22 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) 
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) 
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) 
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 7)
+#define LOGGER_SET_WATERMARK		_IO(__LOGGERIO, 8)
+
+/* Modes for LOGGER_SET_READ_MODE */
+#define LOGGER_READ_SINGLE	0	/* one entry per read(), the default */
+#define LOGGER_READ_BATCH	1	/* as many whole entries as fit */
+
+/*
+ * Argument of LOGGER_SET_WATERMARK: blocking reads and poll only return
+ * once this many bytes (counting kernel headers) or entries are pending.
+ * A zero field is ignored, both zero wakes up for every entry.  The byte
+ * count must be smaller than the log.
+ */
+struct logger_watermark {
+	__u32		bytes;
+	__u32		entries;
+};
 
 #endif 
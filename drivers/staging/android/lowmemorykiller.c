@@ -17,6 +17,15 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Setting /sys/module/lowmemorykiller/parameters/use_pressure to 1 instead
+ * picks the adj level from reclaim efficiency (pages reclaimed vs. scanned):
+ * pressure_min percent selects the highest adj and 100 percent the lowest,
+ * while free memory is below the largest minfree.  Kill statistics are in
+ * /sys/kernel/debug/lowmemorykiller/stats.
+ *
+ * /dev/lowmemorykiller can be polled for level changes; thresholds are
+ * applied with a notify_margin percent head start over the killer.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -34,11 +43,21 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/pid.h>
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -71,28 +90,50 @@ static unsigned long lowmem_deathpending_timeout;
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 0;
 
+static uint32_t lowmem_use_pressure;
+static uint32_t lowmem_pressure_min = 60;
+static uint32_t lowmem_pressure_window = SWAP_CLUSTER_MAX * 16;
+static unsigned long lowmem_last_scanned;
+static unsigned long lowmem_last_reclaimed;
+static int lowmem_pressure;
+static unsigned long lowmem_vm_events[NR_VM_EVENT_ITEMS];
+
+#define LOWMEM_CACHE_SIZE	16
+#define LOWMEM_LAT_BUCKETS	12
+
+/* Holds the pid rather than the task, so exited tasks can be freed */
+struct lowmem_candidate {
+	struct pid *pid;
+	int oom_score_adj;
+	int tasksize;
+};
+
+static struct lowmem_candidate lowmem_cache[LOWMEM_CACHE_SIZE];
+static int lowmem_cache_count;
+static int lowmem_cache_min_adj;
+static unsigned long lowmem_cache_expires;
+static uint32_t lowmem_cache_ttl_ms = 500;
+
+static DEFINE_SPINLOCK(lowmem_victim_lock);
+static struct task_struct *lowmem_victim;
+static ktime_t lowmem_victim_killed;
+static int lowmem_victim_minfree;
+static int lowmem_victim_size;
+
+static struct {
+	unsigned long kills;
+	unsigned long overkills;
+	unsigned long cache_hits;
+	unsigned long cache_rebuilds;
+	unsigned long kill_latency[LOWMEM_LAT_BUCKETS];
+} lowmem_stats;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
-static int test_task_flag(struct task_struct *p, int flag)
-{
-	struct task_struct *t = p;
-
-	do {
-		task_lock(t);
-		if (test_tsk_thread_flag(t, flag)) {
-			task_unlock(t);
-			return 1;
-		}
-		task_unlock(t);
-	} while_each_thread(p, t);
-
-	return 0;
-}
-
 static int
 task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -108,6 +149,261 @@ task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data
 	return NOTIFY_OK;
 }
 
+static int
+task_free_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	unsigned long flags;
+	s64 ms;
+
+	if (task != lowmem_victim)
+		return NOTIFY_OK;
+
+	spin_lock_irqsave(&lowmem_victim_lock, flags);
+	if (task == lowmem_victim) {
+		ms = ktime_to_ms(ktime_sub(ktime_get(), lowmem_victim_killed));
+		lowmem_stats.kill_latency[min_t(int, fls_long(ms),
+						LOWMEM_LAT_BUCKETS - 1)]++;
+		if (global_page_state(NR_FREE_PAGES) >
+		    lowmem_victim_minfree + lowmem_victim_size)
+			lowmem_stats.overkills++;
+		lowmem_victim = NULL;
+	}
+	spin_unlock_irqrestore(&lowmem_victim_lock, flags);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block task_free_nb = {
+	.notifier_call = task_free_notify_func,
+};
+
+/*
+ * Reclaim pressure in percent over the last lowmem_pressure_window
+ * scanned pages: 0 when everything scanned was reclaimed, 100 when
+ * nothing was.
+ */
+static void lowmem_update_pressure(void)
+{
+	unsigned long scanned = 0, reclaimed = 0;
+	unsigned long delta_scanned, delta_reclaimed;
+	int i;
+
+	all_vm_events(lowmem_vm_events);
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		scanned += lowmem_vm_events[PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL + i] +
+			lowmem_vm_events[PGSCAN_DIRECT_NORMAL - ZONE_NORMAL + i];
+		reclaimed += lowmem_vm_events[PGSTEAL_KSWAPD_NORMAL - ZONE_NORMAL + i] +
+			lowmem_vm_events[PGSTEAL_DIRECT_NORMAL - ZONE_NORMAL + i];
+	}
+
+	delta_scanned = scanned - lowmem_last_scanned;
+	if (delta_scanned < lowmem_pressure_window)
+		return;
+	delta_reclaimed = reclaimed - lowmem_last_reclaimed;
+	if (delta_reclaimed >= delta_scanned)
+		lowmem_pressure = 0;
+	else
+		lowmem_pressure = 100 - delta_reclaimed * 100 / delta_scanned;
+	lowmem_last_scanned = scanned;
+	lowmem_last_reclaimed = reclaimed;
+}
+
+/*
+ * Map the current pressure onto the adj levels: pressure_min selects
+ * the highest adj, 100 the lowest.  Nothing is killed while free memory
+ * is above the largest minfree.
+ */
+static int lowmem_pressure_level(int array_size, int other_free,
+				 size_t *min_array)
+{
+	int level;
+
+	if (array_size <= 0 || lowmem_pressure_min > 100 ||
+	    lowmem_pressure < lowmem_pressure_min ||
+	    other_free >= min_array[array_size - 1])
+		return -1;
+
+	level = (lowmem_pressure - lowmem_pressure_min) * array_size /
+		(101 - lowmem_pressure_min);
+	return array_size - 1 - level;
+}
+
+/*
+ * Index into lowmem_adj/minfree of the level the given free and file
+ * page counts fall into, or -1 if none.
+ */
+static int lowmem_select_level(int array_size, int other_free,
+			       int other_file, size_t *min_array)
+{
+	int i;
+
+	if (lowmem_use_pressure)
+		return lowmem_pressure_level(array_size, other_free,
+					     min_array);
+
+	for (i = 0; i < array_size; i++) {
+		if (other_free < min_array[i] &&
+		    other_file < min_array[i])
+			return i;
+	}
+	return -1;
+}
+
+static uint32_t lowmem_notify_margin = 125;
+static atomic_t lowmem_notify_level = ATOMIC_INIT(0);
+static atomic_t lowmem_notify_seq = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+
+/*
+ * Notification level for userspace: the same thresholds with free and
+ * file counts scaled down by notify_margin percent, so that listeners
+ * hear about a level before the killer acts on it.  0 is no pressure,
+ * array_size is the most critical level.
+ */
+static int lowmem_get_notify_level(int array_size, int other_free,
+				   int other_file, size_t *min_array)
+{
+	int margin = max_t(int, lowmem_notify_margin, 100);
+	int i;
+
+	i = lowmem_select_level(array_size, other_free * 100 / margin,
+				other_file * 100 / margin, min_array);
+	return i < 0 ? 0 : array_size - i;
+}
+
+static void lowmem_notify(int level)
+{
+	if (atomic_xchg(&lowmem_notify_level, level) == level)
+		return;
+	atomic_inc(&lowmem_notify_seq);
+	wake_up_interruptible(&lowmem_notify_wait);
+}
+
+static void lowmem_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < lowmem_cache_count; i++)
+		put_pid(lowmem_cache[i].pid);
+	lowmem_cache_count = 0;
+}
+
+static void lowmem_cache_drop(int i)
+{
+	put_pid(lowmem_cache[i].pid);
+	lowmem_cache_count--;
+	memmove(&lowmem_cache[i], &lowmem_cache[i + 1],
+		(lowmem_cache_count - i) * sizeof(lowmem_cache[0]));
+}
+
+/*
+ * Walk all processes once and keep the LOWMEM_CACHE_SIZE best victims
+ * with oom_score_adj >= min_score_adj, ordered by adj then size.
+ */
+static void lowmem_cache_rebuild(int min_score_adj)
+{
+	struct task_struct *tsk;
+	int i;
+
+	lowmem_cache_flush();
+
+	rcu_read_lock();
+	for_each_process(tsk) {
+		struct task_struct *p;
+		int oom_score_adj;
+		int tasksize;
+
+		if (tsk->flags & PF_KTHREAD)
+			continue;
+
+		p = find_lock_task_mm(tsk);
+		if (!p)
+			continue;
+
+		oom_score_adj = p->signal->oom_score_adj;
+		if (oom_score_adj < min_score_adj) {
+			task_unlock(p);
+			continue;
+		}
+		tasksize = get_mm_rss(p->mm);
+		task_unlock(p);
+		if (tasksize <= 0)
+			continue;
+
+		for (i = lowmem_cache_count; i > 0; i--) {
+			struct lowmem_candidate *c = &lowmem_cache[i - 1];
+
+			if (c->oom_score_adj > oom_score_adj ||
+			    (c->oom_score_adj == oom_score_adj &&
+			     c->tasksize >= tasksize))
+				break;
+			if (i < LOWMEM_CACHE_SIZE)
+				lowmem_cache[i] = *c;
+		}
+		if (i >= LOWMEM_CACHE_SIZE)
+			continue;
+		lowmem_cache[i].pid = task_pid(tsk);
+		lowmem_cache[i].oom_score_adj = oom_score_adj;
+		lowmem_cache[i].tasksize = tasksize;
+		if (lowmem_cache_count < LOWMEM_CACHE_SIZE)
+			lowmem_cache_count++;
+	}
+	for (i = 0; i < lowmem_cache_count; i++)
+		get_pid(lowmem_cache[i].pid);
+	rcu_read_unlock();
+
+	lowmem_cache_min_adj = min_score_adj;
+	lowmem_cache_expires = jiffies + msecs_to_jiffies(lowmem_cache_ttl_ms);
+	lowmem_stats.cache_rebuilds++;
+}
+
+/*
+ * Pick the best cached victim using its current adj and size.  Returns
+ * the cache index and the locked thread holding the mm, or -1.
+ */
+static int lowmem_cache_select(int min_score_adj, struct task_struct **pp,
+			       int *sizep, int *adjp)
+{
+	int i, selected = -1;
+
+	*pp = NULL;
+	rcu_read_lock();
+	for (i = 0; i < lowmem_cache_count; i++) {
+		struct task_struct *p;
+		int oom_score_adj;
+		int tasksize;
+
+		p = pid_task(lowmem_cache[i].pid, PIDTYPE_PID);
+		if (p)
+			p = find_lock_task_mm(p);
+		if (!p) {
+			lowmem_cache_drop(i--);
+			continue;
+		}
+		oom_score_adj = p->signal->oom_score_adj;
+		tasksize = get_mm_rss(p->mm);
+		task_unlock(p);
+		if (oom_score_adj < min_score_adj || tasksize <= 0)
+			continue;
+		if (selected >= 0) {
+			if (oom_score_adj < *adjp)
+				continue;
+			if (oom_score_adj == *adjp && tasksize <= *sizep)
+				continue;
+		}
+		selected = i;
+		*pp = p;
+		*sizep = tasksize;
+		*adjp = oom_score_adj;
+	}
+	if (*pp)
+		get_task_struct(*pp);
+	rcu_read_unlock();
+
+	return selected;
+}
+
 static void dump_tasks(void)
 {
 	struct task_struct *p;
@@ -132,15 +428,16 @@ static DEFINE_MUTEX(scan_mutex);
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
-	int selected_oom_score_adj;
+	int selected_oom_score_adj = 0;
 	int selected_oom_adj = 0;
+	int index;
+	int level;
+	int rebuilt = 0;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free;
 	int other_file;
@@ -173,14 +470,17 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 
-	for (i = 0; i < array_size; i++) {
-		if (other_free < min_array[i] &&
-		    other_file < min_array[i]) {
-			min_score_adj = lowmem_adj[i];
-			fork_boost = lowmem_fork_boost_minfree[i];
-			break;
-		}
+	if (lowmem_use_pressure && nr_to_scan > 0)
+		lowmem_update_pressure();
+	level = lowmem_select_level(array_size, other_free, other_file,
+				    min_array);
+	if (level >= 0) {
+		min_score_adj = lowmem_adj[level];
+		if (!lowmem_use_pressure)
+			fork_boost = lowmem_fork_boost_minfree[level];
 	}
+	lowmem_notify(lowmem_get_notify_level(array_size, other_free,
+					      other_file, min_array));
 
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
@@ -199,74 +499,64 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 
 		return rem;
 	}
-	selected_oom_score_adj = min_score_adj;
-
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
-
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				rcu_read_unlock();
-				
-				msleep_interruptible(20);
-				mutex_unlock(&scan_mutex);
-				return 0;
-			}
-		}
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+	if (lowmem_victim &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		msleep_interruptible(20);
+		mutex_unlock(&scan_mutex);
+		return 0;
+	}
 
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
+	if (!lowmem_cache_count || min_score_adj < lowmem_cache_min_adj ||
+	    time_after(jiffies, lowmem_cache_expires)) {
+		lowmem_cache_rebuild(min_score_adj);
+		rebuilt = 1;
+	}
+	index = lowmem_cache_select(min_score_adj, &selected,
+				    &selected_tasksize, &selected_oom_score_adj);
+	if (index < 0 && !rebuilt) {
+		lowmem_cache_rebuild(min_score_adj);
+		index = lowmem_cache_select(min_score_adj, &selected,
+					    &selected_tasksize,
+					    &selected_oom_score_adj);
+	} else if (index >= 0 && !rebuilt) {
+		lowmem_stats.cache_hits++;
 	}
+
 	if (selected) {
+		unsigned long flags;
+
+		selected_oom_adj = selected->signal->oom_adj;
 		lowmem_print(1, "[%s] send sigkill to %d (%s), oom_adj %d, score_adj %d,"
-			" min_score_adj %d, size %dK, free %dK, file %dK, fork_boost %dK\n",
+			" min_score_adj %d, size %dK, free %dK, file %dK, fork_boost %dK, pressure %d\n",
 			     current->comm, selected->pid, selected->comm,
 			     selected_oom_adj, selected_oom_score_adj,
 			     min_score_adj, selected_tasksize << 2,
-			     other_free << 2, other_file << 2, fork_boost << 2);
+			     other_free << 2, other_file << 2, fork_boost << 2,
+			     lowmem_pressure);
 		lowmem_deathpending_timeout = jiffies + HZ;
 		if (selected_oom_adj < 7)
 		{
+			rcu_read_lock();
 			dump_tasks();
+			rcu_read_unlock();
 		}
+		spin_lock_irqsave(&lowmem_victim_lock, flags);
+		lowmem_victim = selected;
+		lowmem_victim_killed = ktime_get();
+		lowmem_victim_minfree = min_array[level];
+		lowmem_victim_size = selected_tasksize;
+		lowmem_stats.kills++;
+		spin_unlock_irqrestore(&lowmem_victim_lock, flags);
+		atomic_inc(&lowmem_notify_seq);
+		wake_up_interruptible(&lowmem_notify_wait);
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		put_task_struct(selected);
+		lowmem_cache_drop(index);
 		rem -= selected_tasksize;
-		rcu_read_unlock();
 		
 		msleep_interruptible(20);
 	}
-	else
-		rcu_read_unlock();
 
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
@@ -279,17 +569,148 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_stats_show(struct seq_file *m, void *unused)
+{
+	int i;
+
+	seq_printf(m, "kills: %lu\n", lowmem_stats.kills);
+	seq_printf(m, "overkills: %lu\n", lowmem_stats.overkills);
+	seq_printf(m, "cache hits: %lu rebuilds: %lu\n",
+		   lowmem_stats.cache_hits, lowmem_stats.cache_rebuilds);
+	seq_printf(m, "pressure: %d%s\n", lowmem_pressure,
+		   lowmem_use_pressure ? "" : " (unused)");
+	seq_puts(m, "kill latency:");
+	for (i = 0; i < LOWMEM_LAT_BUCKETS - 1; i++)
+		seq_printf(m, " <%lums:%lu", 1UL << i,
+			   lowmem_stats.kill_latency[i]);
+	seq_printf(m, " >=%lums:%lu\n", 1UL << (i - 1),
+		   lowmem_stats.kill_latency[i]);
+	return 0;
+}
+
+static int lowmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_stats_show, NULL);
+}
+
+static const struct file_operations lowmem_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs_dir;
+
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(long)(atomic_read(&lowmem_notify_seq) - 1);
+	return nonseekable_open(inode, file);
+}
+
+/*
+ * Each read returns one line with the current level, the oom_score_adj
+ * the killer would use at that level (or OOM_SCORE_ADJ_MAX + 1), free
+ * and file pages and the number of kills.  A read blocks until the
+ * level changed or a kill happened since the previous read on this
+ * file; the first read returns immediately.
+ */
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *pos)
+{
+	int seq = (long)file->private_data;
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int other_free, other_file;
+	int level, adj = OOM_SCORE_ADJ_MAX + 1;
+	char line[96];
+	int len;
+	int ret;
+
+	if (seq == atomic_read(&lowmem_notify_seq)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(lowmem_notify_wait,
+				seq != atomic_read(&lowmem_notify_seq));
+		if (ret)
+			return ret;
+	}
+	seq = atomic_read(&lowmem_notify_seq);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	other_free = global_page_state(NR_FREE_PAGES);
+	other_file = global_page_state(NR_FILE_PAGES) -
+		global_page_state(NR_SHMEM) - global_page_state(NR_MLOCK);
+	level = lowmem_get_notify_level(array_size, other_free, other_file,
+					(size_t *)lowmem_minfree);
+	if (level)
+		adj = lowmem_adj[array_size - level];
+
+	len = scnprintf(line, sizeof(line),
+			"level %d adj %d free %d file %d kills %lu\n",
+			level, adj, other_free, other_file, lowmem_stats.kills);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, line, len))
+		return -EFAULT;
+
+	/* Only consume the event once it has been delivered */
+	file->private_data = (void *)(long)seq;
+	return len;
+}
+
+static unsigned int lowmem_notify_poll(struct file *file,
+				       struct poll_table_struct *wait)
+{
+	int seq = (long)file->private_data;
+
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (seq != atomic_read(&lowmem_notify_seq))
+		return POLLIN | POLLRDNORM | POLLPRI;
+	return 0;
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_notify_open,
+	.read = lowmem_notify_read,
+	.poll = lowmem_notify_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmemorykiller",
+	.fops = &lowmem_notify_fops,
+};
+
 static int __init lowmem_init(void)
 {
 	task_fork_register(&task_fork_nb);
+	task_free_register(&task_free_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_notify_misc))
+		pr_err("lowmemorykiller: failed to register notify device\n");
+	lowmem_debugfs_dir = debugfs_create_dir("lowmemorykiller", NULL);
+	if (lowmem_debugfs_dir)
+		debugfs_create_file("stats", S_IRUGO, lowmem_debugfs_dir,
+				    NULL, &lowmem_stats_fops);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	debugfs_remove_recursive(lowmem_debugfs_dir);
+	misc_deregister(&lowmem_notify_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	task_free_unregister(&task_free_nb);
 	task_fork_unregister(&task_fork_nb);
+	mutex_lock(&scan_mutex);
+	lowmem_cache_flush();
+	mutex_unlock(&scan_mutex);
 }
 
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
@@ -384,6 +805,13 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
+module_param_named(use_pressure, lowmem_use_pressure, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_min, lowmem_pressure_min, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(cache_ttl_ms, lowmem_cache_ttl_ms, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_margin, lowmem_notify_margin, uint,
+		   S_IRUGO | S_IWUSR);
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint,
 			 &lowmem_fork_boost_minfree_size, S_IRUGO | S_IWUSR);
 
@@ -0,0 +1,155 @@
+/*
+ * Compressed RAM block device
+ *
+ * Deduplication of identical compressed pages.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Compression is deterministic, so two pages are identical exactly
+ * when their compressed forms are.  Each stored object is hashed on
+ * its compressed bytes; a new page whose compressed form matches an
+ * existing object takes a reference on it instead of allocating.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Hash buckets per stored page, as a shift of the device page count */
+#define ZRAM_DEDUP_BUCKET_SHIFT	3
+#define ZRAM_DEDUP_MIN_BITS	6
+
+u32 zram_dedup_checksum(const void *cmem, unsigned int len)
+{
+	return jhash(cmem, len, 0);
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum >> (32 - zram->dedup_hash_bits)];
+}
+
+/*
+ * Look for an object with the same compressed contents and take a
+ * reference on it.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram, const void *cmem,
+					 unsigned int len, u32 checksum)
+{
+	struct zram_dedup_entry *entry;
+	struct hlist_node *pos;
+	struct zobj_header *zheader;
+	unsigned char *obj;
+	int match;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+			     node) {
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		obj = zs_map_object(zram->mem_pool, entry->handle);
+		match = !memcmp(obj + sizeof(*zheader), cmem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/* Make a newly stored object findable.  NULL if out of memory. */
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram, void *handle,
+					   unsigned int len, u32 checksum)
+{
+	struct zram_dedup_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference.  Returns 1 if it was the last one and the object
+ * was freed, 0 if other table entries still share it.
+ */
+int zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+
+	return 1;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	unsigned int bits;
+
+	if (!zram->dedup_enable)
+		return 0;
+
+	bits = max_t(unsigned int, ZRAM_DEDUP_MIN_BITS,
+		     ilog2(num_pages >> ZRAM_DEDUP_BUCKET_SHIFT | 1));
+	zram->dedup_hash = vzalloc(sizeof(struct hlist_head) << bits);
+	if (!zram->dedup_hash)
+		return -ENOMEM;
+
+	zram->dedup_hash_bits = bits;
+	spin_lock_init(&zram->dedup_lock);
+
+	return 0;
+}
+
+/* Free every object; only called on reset, with no I/O in flight. */
+void zram_dedup_destroy(struct zram *zram)
+{
+	struct zram_dedup_entry *entry;
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	if (!zram->dedup_hash)
+		return;
+
+	for (i = 0; i < 1U << zram->dedup_hash_bits; i++) {
+		hlist_for_each_entry_safe(entry, pos, n, &zram->dedup_hash[i],
+					  node) {
+			zs_free(zram->mem_pool, entry->handle);
+			kfree(entry);
+		}
+	}
+
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+	zram->dedup_hash_bits = 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Compressed RAM block device
+ *
+ * Deduplication of identical compressed pages.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/list.h>
+
+struct zram;
+
+/*
+ * A compressed object shared by every table entry flagged ZRAM_DEDUP
+ * whose handle points here.  Protected by zram->dedup_lock.
+ */
+struct zram_dedup_entry {
+	struct hlist_node node;
+	void *handle;		/* zsmalloc handle of the object */
+	u32 checksum;		/* of the compressed data */
+	u16 len;		/* compressed length */
+	unsigned int refcount;
+};
+
+u32 zram_dedup_checksum(const void *cmem, unsigned int len);
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram, const void *cmem,
+					 unsigned int len, u32 checksum);
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram, void *handle,
+					   unsigned int len, u32 checksum);
+int zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry);
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_destroy(struct zram *zram);
+
+#endif
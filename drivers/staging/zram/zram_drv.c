@@ -29,9 +29,11 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 #include "zram_drv.h"
 
@@ -89,21 +91,80 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = jiffies;
+}
+
+/* Returns a free backing device block, or 0 if it is full. */
+static unsigned long zram_bd_alloc(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bd_bitmap_lock);
+	blk = find_next_zero_bit(zram->bd_bitmap, zram->nr_bd_pages, 1);
+	if (blk < zram->nr_bd_pages)
+		__set_bit(blk, zram->bd_bitmap);
+	else
+		blk = 0;
+	spin_unlock(&zram->bd_bitmap_lock);
+
+	return blk;
+}
+
+static void zram_bd_free(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bd_bitmap_lock);
+	WARN_ON(!test_bit(blk, zram->bd_bitmap));
+	__clear_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_bitmap_lock);
+}
+#else
+static inline void zram_touch(struct zram *zram, u32 index)
+{
+}
+#endif
+
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned int len, unsigned long element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	if (!element) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	for (pos = 0; pos < len / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+static void *zram_obj_handle(struct zram *zram, u32 index)
+{
+	void *handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_dedup_entry *)handle)->handle;
+	return handle;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -136,6 +197,26 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
+	int shared = 0;
+
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_bd_free(zram, (unsigned long)handle);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram->table[index].handle = NULL;
+		return;
+	}
+#endif
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].handle = NULL;
+		return;
+	}
 
 	if (unlikely(!handle)) {
 		/*
@@ -156,27 +237,35 @@ static void zram_free_page(struct zram *zram, size_t index)
 		goto out;
 	}
 
-	zs_free(zram->mem_pool, handle);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		shared = !zram_dedup_put(zram, handle);
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
 	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size,
-			zram->table[index].size);
+	if (shared)
+		zram_stat_dec(&zram->stats.pages_dup);
+	else
+		zram_stat64_sub(zram, &zram->stats.compr_size,
+				zram->table[index].size);
 	zram_stat_dec(&zram->stats.pages_stored);
 
 	zram->table[index].handle = NULL;
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -203,55 +292,256 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+static struct zram_comp_strm *zram_comp_strm_get(struct zram *zram)
+{
+	struct zram_comp_strm *strm;
+
+	strm = per_cpu_ptr(zram->comp_strm, raw_smp_processor_id());
+	mutex_lock(&strm->lock);
+	return strm;
+}
+
+static void zram_comp_strm_put(struct zram_comp_strm *strm)
+{
+	mutex_unlock(&strm->lock);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+struct zram_bd_io {
+	struct completion done;
+	int error;
+};
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_io *io = bio->bi_private;
+
+	if (!err && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		err = -EIO;
+	io->error = err;
+	complete(&io->done);
+}
+
+/* Synchronous single page I/O on the backing device. */
+static int zram_bd_rw(struct zram *zram, struct page *page,
+		      unsigned long blk, int rw)
+{
+	struct zram_bd_io io;
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+	init_completion(&io.done);
+	io.error = 0;
+	bio->bi_private = &io;
+	bio->bi_end_io = zram_bd_end_io;
+
+	submit_bio(rw, bio);
+	wait_for_completion(&io.done);
+	bio_put(bio);
+
+	return io.error;
+}
+
+struct zram_bd_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_work *w = container_of(work, struct zram_bd_work, work);
+
+	w->ret = zram_bd_rw(w->zram, w->page, w->blk, READ);
+}
+
+/*
+ * Reads come in from our own make_request function, where a bio
+ * submitted to another queue is only dispatched after we return.
+ * Issue it from a worker and wait for that instead.
+ */
+static int zram_bd_read(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bd_work w;
+	ktime_t start = ktime_get();
+	u64 lat;
+
+	w.zram = zram;
+	w.page = page;
+	w.blk = blk;
+	INIT_WORK_ONSTACK(&w.work, zram_bd_read_work);
+	queue_work(system_unbound_wq, &w.work);
+	flush_work(&w.work);
+	destroy_work_on_stack(&w.work);
+
+	lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_lock(&zram->stat64_lock);
+	zram->stats.bd_reads++;
+	zram->stats.bd_read_ns += lat;
+	if (lat > zram->stats.bd_read_max_ns)
+		zram->stats.bd_read_max_ns = lat;
+	spin_unlock(&zram->stat64_lock);
+
+	return w.ret;
+}
+
+static int zram_bd_read_mem(struct zram *zram, unsigned long blk,
+			    unsigned char *mem)
+{
+	struct page *page;
+	unsigned char *src;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_bd_read(zram, page, blk);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	}
+	__free_page(page);
+
+	return ret;
+}
+
+/* uncmem is a PAGE_SIZE bounce buffer for partial I/O, else unused */
+static int zram_bd_read_bvec(struct zram *zram, unsigned long blk,
+			     struct bio_vec *bvec, int offset,
+			     unsigned char *uncmem)
+{
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem;
+	int ret;
+
+	if (!is_partial_io(bvec)) {
+		ret = zram_bd_read(zram, page, blk);
+	} else {
+		ret = zram_bd_read_mem(zram, blk, uncmem);
+		if (!ret) {
+			user_mem = kmap_atomic(page);
+			memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+			       bvec->bv_len);
+			kunmap_atomic(user_mem);
+		}
+	}
+	if (!ret)
+		flush_dcache_page(page);
+
+	return ret;
+}
+#endif
+
+/* Caller holds tb_lock and the stream; mem must be PAGE_SIZE bytes. */
+static int zram_decompress_page(struct zram *zram, struct zram_comp_strm *strm,
+				unsigned char *mem, u32 index)
+{
+	int ret;
+	unsigned int clen = PAGE_SIZE;
+	struct zobj_header *zheader;
+	unsigned char *cmem;
+	void *handle = zram_obj_handle(zram, index);
+
+	cmem = zs_map_object(zram->mem_pool, handle);
+	ret = crypto_comp_decompress(strm->tfm, cmem + sizeof(*zheader),
+				     zram->table[index].size, mem, &clen);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	if (!ret && clen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem, *uncmem = NULL;
+	struct zram_comp_strm *strm;
+	unsigned char *user_mem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+	strm = zram_comp_strm_get(zram);
+	read_lock(&zram->tb_lock);
+	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_SAME)) {
+		unsigned long element = (unsigned long)zram->table[index].handle;
+
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		kfree(uncmem);
+		handle_same_page(bvec, element);
 		return 0;
 	}
 
 	/* Requested page is not present in compressed area */
 	if (unlikely(!zram->table[index].handle)) {
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		kfree(uncmem);
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
+		handle_same_page(bvec, 0);
 		return 0;
 	}
 
+	zram_touch(zram, index);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		unsigned long blk = (unsigned long)zram->table[index].handle;
+
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		ret = zram_bd_read_bvec(zram, blk, bvec, offset, uncmem);
+		kfree(uncmem);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
+			       ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+		}
+		return ret;
+	}
+#endif
+
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		kfree(uncmem);
 		return 0;
 	}
 
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
-	}
-
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
-
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zram_decompress_page(zram, strm, uncmem, index);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -259,11 +549,12 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
 	kunmap_atomic(user_mem);
+	read_unlock(&zram->tb_lock);
+	zram_comp_strm_put(strm);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -274,35 +565,58 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+static int zram_read_before_write(struct zram *zram, unsigned char *mem,
+				  u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
+	struct zram_comp_strm *strm;
 	unsigned char *cmem;
 
+	strm = zram_comp_strm_get(zram);
+	read_lock(&zram->tb_lock);
 	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
 	    !zram->table[index].handle) {
-		memset(mem, 0, PAGE_SIZE);
+		unsigned long element = (unsigned long)zram->table[index].handle;
+
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		zram_fill_page(mem, PAGE_SIZE, element);
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		unsigned long blk = (unsigned long)zram->table[index].handle;
+
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
+		ret = zram_bd_read_mem(zram, blk, mem);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
+			       ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+		}
+		return ret;
+	}
+#endif
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
+		read_unlock(&zram->tb_lock);
+		zram_comp_strm_put(strm);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	ret = zram_decompress_page(zram, strm, mem, index);
+	read_unlock(&zram->tb_lock);
+	zram_comp_strm_put(strm);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -311,19 +625,168 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static bool zram_wb_eligible(struct zram *zram, u32 index,
+			     enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return false;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return time_after_eq(jiffies, zram->table[index].ac_time +
+			     zram->wb_idle_age * HZ);
+}
+
+/*
+ * Move matching pages to the backing device.  Each page is marked
+ * ZRAM_UNDER_WB, read out and written back without tb_lock held; it
+ * only replaces the in-memory copy if nothing freed or overwrote the
+ * slot in the meantime.  Caller holds init_lock for read.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	size_t index, nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long blk = 0;
+	struct page *page;
+	unsigned char *mem;
+	int ret = 0;
+
+	if (!zram->backing_bdev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+	for (index = 0; index < nr_pages; index++) {
+		if (!blk) {
+			blk = zram_bd_alloc(zram);
+			if (!blk) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		write_lock(&zram->tb_lock);
+		if (!zram_wb_eligible(zram, index, mode)) {
+			write_unlock(&zram->tb_lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+
+		mem = kmap(page);
+		ret = zram_read_before_write(zram, mem, index);
+		kunmap(page);
+		if (!ret)
+			ret = zram_bd_rw(zram, page, blk, WRITE);
+		if (ret) {
+			write_lock(&zram->tb_lock);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			break;
+		}
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+		write_lock(&zram->tb_lock);
+		if (zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].handle = (void *)blk;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat_inc(&zram->stats.pages_wb);
+			blk = 0;
+		}
+		write_unlock(&zram->tb_lock);
+		cond_resched();
+	}
+	mutex_unlock(&zram->wb_lock);
+
+	if (blk)
+		zram_bd_free(zram, blk);
+	__free_page(page);
+
+	return ret;
+}
+
+void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_bdev)
+		return;
+
+	blkdev_put(zram->backing_bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bd_bitmap);
+	kfree(zram->backing_dev_path);
+	zram->backing_bdev = NULL;
+	zram->bd_bitmap = NULL;
+	zram->backing_dev_path = NULL;
+	zram->nr_bd_pages = 0;
+}
+
+/* Caller holds init_lock for write and the device is not initialized. */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap;
+	char *name;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(name, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev)) {
+		kfree(name);
+		return PTR_ERR(bdev);
+	}
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		kfree(name);
+		return -EINVAL;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		kfree(name);
+		return -ENOMEM;
+	}
+
+	zram_reset_backing_dev(zram);
+	zram->backing_bdev = bdev;
+	zram->backing_dev_path = name;
+	zram->bd_bitmap = bitmap;
+	zram->nr_bd_pages = nr_pages;
+	pr_info("Using %s as backing device, %lu pages\n", name, nr_pages);
+
+	return 0;
+}
+#endif
+
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
-	size_t clen;
+	unsigned int clen;
 	void *handle;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	struct page *page, *page_store = NULL;
+	struct zram_comp_strm *strm;
+	struct zram_dedup_entry *entry = NULL, *new_entry = NULL;
+	unsigned long element;
+	u32 checksum = 0;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -344,41 +807,54 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	}
 
 	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
+	 * Compress into this CPU's stream so that writers on other CPUs
+	 * can run in parallel.  The table is only locked to install the
+	 * result; partial writes also hold partial_lock throughout.
 	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
+	strm = zram_comp_strm_get(zram);
 	user_mem = kmap_atomic(page);
 
-	if (is_partial_io(bvec))
+	if (is_partial_io(bvec)) {
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
-	else
+		kunmap_atomic(user_mem);
+		user_mem = NULL;
+	} else {
 		uncmem = user_mem;
+	}
 
-	if (page_zero_filled(uncmem)) {
-		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
+	if (page_same_filled(uncmem, &element)) {
+		if (user_mem)
+			kunmap_atomic(user_mem);
+		else
 			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_comp_strm_put(strm);
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
+		if (!element) {
+			zram_stat_inc(&zram->stats.pages_zero);
+			zram_set_flag(zram, index, ZRAM_ZERO);
+		} else {
+			zram->table[index].handle = (void *)element;
+			zram_stat_inc(&zram->stats.pages_same);
+			zram_set_flag(zram, index, ZRAM_SAME);
+		}
+		zram_touch(zram, index);
+		write_unlock(&zram->tb_lock);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(strm->tfm, uncmem, PAGE_SIZE, strm->buffer,
+				   &clen);
 
-	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (user_mem)
+		kunmap_atomic(user_mem);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
-		goto out;
+		goto out_put;
 	}
 
 	/*
@@ -393,57 +869,84 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			pr_info("Error allocating memory for "
 				"incompressible page: %u\n", index);
 			ret = -ENOMEM;
-			goto out;
+			goto out_put;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
 		handle = page_store;
-		src = kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
-		goto memstore;
-	}
-
-	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
-	if (!handle) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
-	}
-	cmem = zs_map_object(zram->mem_pool, handle);
-
-memstore:
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
-
-	memcpy(cmem, src, clen);
-
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		src = is_partial_io(bvec) ? uncmem : kmap_atomic(page);
+		memcpy(cmem, src, clen);
+		if (!is_partial_io(bvec))
+			kunmap_atomic(src);
 		kunmap_atomic(cmem);
-		kunmap_atomic(src);
 	} else {
+		if (zram->dedup_hash) {
+			checksum = zram_dedup_checksum(strm->buffer, clen);
+			entry = zram_dedup_find(zram, strm->buffer, clen,
+						checksum);
+			if (entry) {
+				handle = entry;
+				goto stored;
+			}
+		}
+
+		handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
+		if (!handle) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%u\n", index, clen);
+			ret = -ENOMEM;
+			goto out_put;
+		}
+		cmem = zs_map_object(zram->mem_pool, handle);
+		memcpy(cmem + sizeof(*zheader), strm->buffer, clen);
 		zs_unmap_object(zram->mem_pool, handle);
+
+		/* Not being able to share it later is no reason to fail */
+		if (zram->dedup_hash) {
+			new_entry = zram_dedup_insert(zram, handle, clen,
+						      checksum);
+			if (new_entry)
+				handle = new_entry;
+		}
 	}
+stored:
+	zram_comp_strm_put(strm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
 
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
+	zram_touch(zram, index);
+	if (page_store) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+	if (entry || new_entry)
+		zram_set_flag(zram, index, ZRAM_DEDUP);
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
+	if (entry)
+		zram_stat_inc(&zram->stats.pages_dup);
+	write_unlock(&zram->tb_lock);
+	if (!entry)
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
 	return 0;
 
+out_put:
+	zram_comp_strm_put(strm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 out:
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
@@ -456,13 +959,18 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 	int ret;
 
 	if (rw == READ) {
-		down_read(&zram->lock);
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
+	} else if (is_partial_io(bvec)) {
+		/*
+		 * A partial write rewrites the whole page from its old
+		 * contents, so another one to the same page must not start
+		 * until this one is installed or its update would be lost.
+		 */
+		mutex_lock(&zram->partial_lock);
+		ret = zram_bvec_write(zram, bvec, index, offset);
+		mutex_unlock(&zram->partial_lock);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -577,6 +1085,54 @@ error:
 	bio_io_error(bio);
 }
 
+static void zram_comp_strm_destroy(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp_strm)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *strm = per_cpu_ptr(zram->comp_strm, cpu);
+
+		if (strm->tfm)
+			crypto_free_comp(strm->tfm);
+		free_pages((unsigned long)strm->buffer, 1);
+	}
+	free_percpu(zram->comp_strm);
+	zram->comp_strm = NULL;
+}
+
+static int zram_comp_strm_create(struct zram *zram)
+{
+	int cpu;
+
+	zram->comp_strm = alloc_percpu(struct zram_comp_strm);
+	if (!zram->comp_strm)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *strm = per_cpu_ptr(zram->comp_strm, cpu);
+
+		mutex_init(&strm->lock);
+		strm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(strm->tfm)) {
+			int ret = PTR_ERR(strm->tfm);
+
+			strm->tfm = NULL;
+			zram_comp_strm_destroy(zram);
+			return ret;
+		}
+		strm->buffer =
+			(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+		if (!strm->buffer) {
+			zram_comp_strm_destroy(zram);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -584,16 +1140,14 @@ void __zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_comp_strm_destroy(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		void *handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_DEDUP))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
@@ -602,12 +1156,19 @@ void __zram_reset_device(struct zram *zram)
 			zs_free(zram->mem_pool, handle);
 	}
 
+	/* Shared objects are freed once, through their dedup entries */
+	zram_dedup_destroy(zram);
+
 	vfree(zram->table);
 	zram->table = NULL;
 
 	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_backing_dev(zram);
+#endif
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -635,18 +1196,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_comp_strm_create(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+		       zram->compressor);
 		goto fail_no_table;
 	}
 
@@ -670,6 +1223,12 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating deduplication hash\n");
+		goto fail;
+	}
+
 	zram->init_done = 1;
 	up_write(&zram->init_lock);
 
@@ -692,7 +1251,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -705,8 +1266,16 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
+	rwlock_init(&zram->tb_lock);
+	mutex_init(&zram->partial_lock);
 	init_rwsem(&zram->init_lock);
+	strlcpy(zram->compressor, ZRAM_DEFAULT_COMPRESSOR,
+		sizeof(zram->compressor));
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bd_bitmap_lock);
+	mutex_init(&zram->wb_lock);
+	zram->wb_idle_age = default_wb_idle_age;
+#endif
 	spin_lock_init(&zram->stat64_lock);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -43,6 +45,12 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compression algorithm, see comp_algorithm in sysfs */
+#define ZRAM_DEFAULT_COMPRESSOR	"lzo"
+
+/* Default seconds without access before 'writeback idle' takes a page */
+static const unsigned default_wb_idle_age = 600;
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -74,6 +82,18 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is one repeated word, kept in handle */
+	ZRAM_SAME,
+
+	/* Object is shared, handle is its struct zram_dedup_entry */
+	ZRAM_DEDUP,
+
+	/* Page is on the backing device, handle is its block index */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if it is freed meanwhile */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -85,6 +105,9 @@ struct table {
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of last read or write */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -95,20 +118,38 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 bd_writes;		/* no. of pages written to backing device */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_read_ns;		/* total backing device read latency */
+	u64 bd_read_max_ns;	/* worst backing device read latency */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_wb;		/* no. of pages on backing device */
+	u32 pages_same;		/* no. of non-zero same filled pages */
+	u32 pages_dup;		/* no. of pages sharing another's object */
+};
+
+/*
+ * Compressor transform and output buffer.  There is one per possible
+ * CPU; the lock only matters when a task migrates while using it and
+ * another one starts on its old CPU.
+ */
+struct zram_comp_strm {
+	struct mutex lock;
+	struct crypto_comp *tfm;
+	void *buffer;
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_comp_strm __percpu *comp_strm;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	rwlock_t tb_lock;	/* protect table entries and 32-bit stats
+				 * against concurrent read, write and free */
+	struct mutex partial_lock;	/* serialize partial page writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +160,20 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	int dedup_enable;
+	struct hlist_head *dedup_hash;
+	unsigned int dedup_hash_bits;
+	spinlock_t dedup_lock;	/* protect dedup_hash and entry refcounts */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct block_device *backing_bdev;
+	char *backing_dev_path;
+	unsigned long *bd_bitmap;	/* used blocks, block 0 is never used */
+	unsigned long nr_bd_pages;
+	spinlock_t bd_bitmap_lock;
+	unsigned int wb_idle_age;	/* seconds */
+	struct mutex wb_lock;		/* one writeback pass at a time */
+#endif
 
 	struct zram_stats stats;
 };
@@ -129,6 +184,17 @@ unsigned int zram_get_num_devices(void);
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,	/* pages stored uncompressed */
+	ZRAM_WB_IDLE,	/* pages not accessed for wb_idle_age seconds */
+};
+
+int zram_set_backing_dev(struct zram *zram, const char *path);
+void zram_reset_backing_dev(struct zram *zram);
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
+
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
 
@@ -0,0 +1,47 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  An implementation of the LZ4 block format, which trades some
+ *  compression ratio against LZO for considerably faster decompression.
+ *  Format description: http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(unsigned int))
+
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dst     : output buffer address of the compressed data
+ *	dst_len : in: size of the output buffer
+ *		  out: size of the compressed data
+ *	wrkmem  : address of the working memory, LZ4_MEM_COMPRESS bytes
+ *	return  : 0 on success, -1 if the output did not fit in dst_len
+ *		  bytes (never the case if it is lz4_compressbound(src_len))
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src     : source address of the compressed data
+ *	src_len : exact size of the compressed data
+ *	dest    : output buffer address of the decompressed data
+ *	dest_len: in: size of the output buffer
+ *		  out: size of the decompressed data
+ *	return  : 0 on success, -1 if the input is malformed or does not
+ *		  fit in dest_len bytes
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+				     unsigned char *dest, size_t *dest_len);
+
+#endif
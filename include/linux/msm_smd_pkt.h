@@ -14,10 +14,64 @@
 #define __LINUX_MSM_SMD_PKT_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define SMD_PKT_IOCTL_MAGIC (0xC2)
 
 #define SMD_PKT_IOCTL_BLOCKING_WRITE \
 	_IOR(SMD_PKT_IOCTL_MAGIC, 0, unsigned int)
 
+/*
+ * Move up to @count packets in one call.  SMD_PKT_IOCTL_READV blocks for
+ * the first packet only, then takes whatever else has fully arrived, and
+ * sets the len of each filled iovec to the size of its packet.  Both
+ * return the number of packets moved.
+ */
+struct smd_pkt_iovec {
+	void *buf;
+	__u32 len;
+};
+
+struct smd_pkt_batch {
+	struct smd_pkt_iovec *iov;
+	__u32 count;
+};
+
+#define SMD_PKT_BATCH_MAX 64
+
+#define SMD_PKT_IOCTL_READV \
+	_IOWR(SMD_PKT_IOCTL_MAGIC, 1, struct smd_pkt_batch)
+
+#define SMD_PKT_IOCTL_WRITEV \
+	_IOW(SMD_PKT_IOCTL_MAGIC, 2, struct smd_pkt_batch)
+
+/*
+ * Receive ring shared with userspace through mmap().  The header sits in
+ * the first SMD_PKT_RING_HDR_SIZE bytes and is followed by @nr_slots
+ * slots of @slot_size bytes, each a __u32 packet length and the packet.
+ * SMD_PKT_IOCTL_RING_FILL blocks until a packet arrives, moves every
+ * complete packet that fits into the ring, advances @head and returns
+ * the number of slots waiting to be consumed.  Userspace advances @tail.
+ */
+struct smd_pkt_ring_req {
+	__u32 nr_slots;
+	__u32 slot_size;
+};
+
+struct smd_pkt_ring_hdr {
+	__u32 nr_slots;
+	__u32 slot_size;
+	__u32 head;
+	__u32 tail;
+};
+
+#define SMD_PKT_RING_HDR_SIZE 4096
+#define SMD_PKT_RING_MAX_SIZE (1024 * 1024)
+
+#define SMD_PKT_IOCTL_RING_SETUP \
+	_IOW(SMD_PKT_IOCTL_MAGIC, 3, struct smd_pkt_ring_req)
+
+#define SMD_PKT_IOCTL_RING_FILL \
+	_IO(SMD_PKT_IOCTL_MAGIC, 4)
+
 #endif 
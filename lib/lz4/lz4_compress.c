@@ -0,0 +1,151 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  Single pass, greedy matcher over a 4096 entry hash table of 4 byte
+ *  sequences, producing the LZ4 block format.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Number of equal bytes at p and ref, stopping at limit. */
+static inline size_t lz4_count(const unsigned char *p,
+			       const unsigned char *ref,
+			       const unsigned char *limit)
+{
+	const unsigned char *start = p;
+
+	while (p + sizeof(long) <= limit) {
+		unsigned long diff = LZ4_READ_LONG(p) ^ LZ4_READ_LONG(ref);
+
+		if (diff) {
+#ifdef __LITTLE_ENDIAN
+			return p - start + (__ffs(diff) >> 3);
+#else
+			break;
+#endif
+		}
+		p += sizeof(long);
+		ref += sizeof(long);
+	}
+	while (p < limit && *p == *ref) {
+		p++;
+		ref++;
+	}
+	return p - start;
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+	unsigned char *token;
+	size_t lit, ml;
+
+	if (src_len > 0x7fffffffU)
+		return -1;
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *ref;
+		u32 h = lz4_hash(LZ4_READ32(ip));
+
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    LZ4_READ32(ref) != LZ4_READ32(ip)) {
+			ip += 1 + ((ip - anchor) >> SKIP_STRENGTH);
+			continue;
+		}
+
+		/* Extend the match backwards over pending literals. */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		lit = ip - anchor;
+		ml = lz4_count(ip + MINMATCH, ref + MINMATCH, matchlimit);
+
+		if (op + 1 + lit + lit / 255 + 1 + 2 + ml / 255 + 1 > oend)
+			return -1;
+
+		token = op++;
+		if (lit >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit - RUN_MASK);
+		} else {
+			*token = lit << ML_BITS;
+		}
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (ml >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, ml - ML_MASK);
+		} else {
+			*token |= ml;
+		}
+
+		ip += ml + MINMATCH;
+		anchor = ip;
+		if (ip >= mflimit)
+			break;
+		table[lz4_hash(LZ4_READ32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	lit = iend - anchor;
+	if (op + 1 + lit + lit / 255 + 1 > oend)
+		return -1;
+	if (lit >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit - RUN_MASK);
+	} else {
+		*op++ = lit << ML_BITS;
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
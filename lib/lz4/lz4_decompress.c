@@ -0,0 +1,110 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  Every length and offset is checked against the input and output
+ *  bounds, so malformed input can not read or write out of range.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const unsigned char **ipp,
+				 const unsigned char *iend, size_t *len)
+{
+	const unsigned char *ip = *ipp;
+	unsigned int s;
+
+	do {
+		if (ip >= iend)
+			return -1;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+				     unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char * const oend = dest + *dest_len;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t length, offset;
+
+	if (!src_len)
+		return -1;
+
+	for (;;) {
+		if (ip >= iend)
+			return -1;
+		token = *ip++;
+
+		length = token >> ML_BITS;
+		if (length == RUN_MASK && lz4_get_length(&ip, iend, &length))
+			return -1;
+		if (length > (size_t)(iend - ip) ||
+		    length > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* The last sequence has literals only. */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - dest))
+			return -1;
+		ref = op - offset;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK && lz4_get_length(&ip, iend, &length))
+			return -1;
+		length += MINMATCH;
+		if (length > (size_t)(oend - op))
+			return -1;
+
+		/*
+		 * The match may overlap the bytes it produces.  Whole words
+		 * are safe once the offset is at least a word.
+		 */
+		if (offset >= 8) {
+			while (length >= 8) {
+				LZ4_COPY8(op, ref);
+				op += 8;
+				ref += 8;
+				length -= 8;
+			}
+		}
+		while (length--)
+			*op++ = *ref++;
+	}
+
+	*dest_len = op - dest;
+	return 0;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
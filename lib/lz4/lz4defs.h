@@ -0,0 +1,38 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants and helpers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * A sequence is a token byte, optional extra literal length bytes, the
+ * literals, a little-endian 16 bit match offset and optional extra match
+ * length bytes.  The high nibble of the token holds the literal length
+ * and the low nibble the match length minus MINMATCH; a nibble of 15
+ * means more length bytes follow, each adding up to 255.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAX_DISTANCE	65535
+
+/*
+ * The last match must start at least MFLIMIT bytes before the end of
+ * the input and the last LASTLITERALS bytes are always literals, so
+ * the decoder can copy in whole words without checking every byte.
+ */
+#define LASTLITERALS	5
+#define MFLIMIT		12
+
+#define SKIP_STRENGTH	6
+
+#define LZ4_READ32(p)		get_unaligned((const u32 *)(p))
+#define LZ4_READ_LONG(p)	get_unaligned((const unsigned long *)(p))
+#define LZ4_COPY8(dst, src)	\
+		put_unaligned(get_unaligned((const u64 *)(src)), (u64 *)(dst))
@@ -0,0 +1,453 @@
+/*
+ * Binder transaction throughput benchmark.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Registers a context manager backed by a pool of looper threads, then
+ * runs 1..N client threads in a separate process, each issuing
+ * synchronous transactions to handle 0, and reports the aggregate rate
+ * for every thread count.  With -g the payload is instead split into
+ * that many scatter-gather buffers sent with BC_TRANSACTION_SG.
+ *
+ * -r runs the clients as SCHED_FIFO and -b adds CPU-bound background
+ * processes; with the per-call latency percentiles this shows whether
+ * the server threads inherit the callers' priority.  The context
+ * manager can only be claimed once, so this must run on a system
+ * without servicemanager.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define BINDER_VM_SIZE		(1024 * 1024)
+#define MAX_THREADS		16
+#define MAX_SG_BUFFERS		16
+#define MAX_BACKGROUND		32
+
+static int iterations = 20000;
+static int max_threads = 4;
+static size_t payload_size = 64;
+static int sg_buffers;
+static int rt_prio;
+static int background;
+
+static int binder_fd;
+
+static int binder_open_dev(void)
+{
+	struct binder_version vers;
+	void *map;
+	int fd;
+
+	fd = open(BINDER_DEV, O_RDWR);
+	if (fd < 0) {
+		perror("open " BINDER_DEV);
+		return -1;
+	}
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder: protocol version mismatch\n");
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int binder_write(int fd, void *data, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+	return ioctl(fd, BINDER_WRITE_READ, &bwr);
+}
+
+static int binder_free_buffer(int fd, const void *buffer)
+{
+	struct {
+		uint32_t cmd;
+		const void *buffer;
+	} __attribute__((packed)) cmd;
+
+	cmd.cmd = BC_FREE_BUFFER;
+	cmd.buffer = buffer;
+	return binder_write(fd, &cmd, sizeof(cmd));
+}
+
+/*
+ * Walk a read buffer.  Returns 1 and fills in *cmdp and *txn if a
+ * BR_TRANSACTION or BR_REPLY was found, 0 if none was present, or -1
+ * on an error return.
+ */
+static int binder_parse(uint8_t *ptr, size_t size, uint32_t *cmdp,
+			struct binder_transaction_data *txn)
+{
+	uint8_t *end = ptr + size;
+	int found = 0;
+
+	while (ptr < end) {
+		uint32_t cmd = *(uint32_t *)ptr;
+
+		ptr += sizeof(uint32_t);
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+		case BR_RELEASE:
+		case BR_DECREFS:
+			ptr += sizeof(struct binder_ptr_cookie);
+			break;
+		case BR_DEAD_BINDER:
+		case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+			ptr += sizeof(void *);
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(txn, ptr, sizeof(*txn));
+			ptr += sizeof(*txn);
+			*cmdp = cmd;
+			found = 1;
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			fprintf(stderr, "binder: transaction failed (%x)\n",
+				cmd);
+			return -1;
+		default:
+			fprintf(stderr, "binder: unexpected return %x\n", cmd);
+			return -1;
+		}
+	}
+	return found;
+}
+
+static void *server_thread(void *arg)
+{
+	uint32_t looper = BC_ENTER_LOOPER;
+	uint8_t readbuf[256];
+	struct binder_transaction_data txn;
+	struct binder_write_read bwr;
+	uint32_t cmd;
+	struct {
+		uint32_t free_cmd;
+		const void *buffer;
+		uint32_t reply_cmd;
+		struct binder_transaction_data reply;
+	} __attribute__((packed)) out;
+
+	(void)arg;
+	if (binder_write(binder_fd, &looper, sizeof(looper)) < 0) {
+		perror("BC_ENTER_LOOPER");
+		return NULL;
+	}
+
+	for (;;) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(readbuf);
+		bwr.read_buffer = (unsigned long)readbuf;
+		if (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("server BINDER_WRITE_READ");
+			return NULL;
+		}
+		if (binder_parse(readbuf, bwr.read_consumed, &cmd, &txn) != 1 ||
+		    cmd != BR_TRANSACTION)
+			continue;
+
+		/* Free the request and echo its payload back. */
+		memset(&out, 0, sizeof(out));
+		out.free_cmd = BC_FREE_BUFFER;
+		out.buffer = txn.data.ptr.buffer;
+		out.reply_cmd = BC_REPLY;
+		out.reply.code = txn.code;
+		out.reply.data_size = txn.data_size;
+		out.reply.data.ptr.buffer = txn.data.ptr.buffer;
+		binder_write(binder_fd, &out, sizeof(out));
+	}
+	return NULL;
+}
+
+static int run_server(int ready_fd)
+{
+	pthread_t threads[MAX_THREADS];
+	char ok = 1;
+	int i;
+
+	binder_fd = binder_open_dev();
+	if (binder_fd < 0)
+		return 1;
+	if (ioctl(binder_fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		ok = 0;
+		write(ready_fd, &ok, 1);
+		return 1;
+	}
+	for (i = 0; i < max_threads; i++)
+		pthread_create(&threads[i], NULL, server_thread, NULL);
+	write(ready_fd, &ok, 1);
+	for (i = 0; i < max_threads; i++)
+		pthread_join(threads[i], NULL);
+	return 0;
+}
+
+static long elapsed_ns(const struct timespec *start,
+		       const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000L +
+		end->tv_nsec - start->tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void *client_thread(void *arg)
+{
+	uint8_t readbuf[256];
+	uint8_t *payload;
+	struct binder_transaction_data reply;
+	struct binder_write_read bwr;
+	struct binder_buffer_object objs[MAX_SG_BUFFERS];
+	size_t offsets[MAX_SG_BUFFERS];
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data_sg txn;
+	} __attribute__((packed)) out;
+	size_t out_size;
+	long *latency = arg;
+	struct timespec start, end;
+	long failures = 0;
+	uint32_t cmd = 0;
+	int i, ret = 0;
+
+	if (rt_prio) {
+		struct sched_param param = { .sched_priority = rt_prio };
+
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+			fprintf(stderr, "client: cannot set SCHED_FIFO\n");
+	}
+	payload = calloc(1, payload_size);
+	for (i = 0; i < sg_buffers; i++) {
+		size_t chunk = payload_size / sg_buffers;
+
+		memset(&objs[i], 0, sizeof(objs[i]));
+		objs[i].type = BINDER_TYPE_PTR;
+		objs[i].buffer = payload + i * chunk;
+		objs[i].length = i == sg_buffers - 1 ?
+			payload_size - i * chunk : chunk;
+		offsets[i] = i * sizeof(objs[i]);
+	}
+	for (i = 0; i < iterations; i++) {
+		memset(&out, 0, sizeof(out));
+		out.txn.transaction_data.target.handle = 0;
+		out.txn.transaction_data.code = i;
+		if (sg_buffers) {
+			out.cmd = BC_TRANSACTION_SG;
+			out.txn.transaction_data.data_size =
+				sg_buffers * sizeof(objs[0]);
+			out.txn.transaction_data.offsets_size =
+				sg_buffers * sizeof(offsets[0]);
+			out.txn.transaction_data.data.ptr.buffer = objs;
+			out.txn.transaction_data.data.ptr.offsets = offsets;
+			out.txn.buffers_size = payload_size + sg_buffers * 8;
+			out_size = sizeof(out);
+		} else {
+			out.cmd = BC_TRANSACTION;
+			out.txn.transaction_data.data_size = payload_size;
+			out.txn.transaction_data.data.ptr.buffer = payload;
+			out_size = sizeof(uint32_t) +
+				sizeof(struct binder_transaction_data);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.write_size = out_size;
+		bwr.write_buffer = (unsigned long)&out;
+		do {
+			bwr.read_size = sizeof(readbuf);
+			bwr.read_consumed = 0;
+			bwr.read_buffer = (unsigned long)readbuf;
+			if (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("client BINDER_WRITE_READ");
+				free(payload);
+				return (void *)(long)(iterations - i);
+			}
+			bwr.write_size = 0;
+			ret = binder_parse(readbuf, bwr.read_consumed, &cmd,
+					   &reply);
+		} while (ret == 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		latency[i] = elapsed_ns(&start, &end);
+
+		if (ret < 0 || cmd != BR_REPLY) {
+			failures++;
+			continue;
+		}
+		binder_free_buffer(binder_fd, reply.data.ptr.buffer);
+	}
+	free(payload);
+	return (void *)failures;
+}
+
+static int run_client(int nthreads)
+{
+	pthread_t threads[MAX_THREADS];
+	struct timespec start, end;
+	long failures = 0;
+	long *latency;
+	long total = (long)nthreads * iterations;
+	double secs;
+	void *res;
+	int i;
+
+	binder_fd = binder_open_dev();
+	if (binder_fd < 0)
+		return 1;
+	latency = calloc(total, sizeof(*latency));
+	if (!latency)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, client_thread,
+			       latency + (long)i * iterations);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], &res);
+		failures += (long)res;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = elapsed_ns(&start, &end) / 1e9;
+	qsort(latency, total, sizeof(*latency), cmp_long);
+	printf("threads %2d: %8.0f transactions/s (%d x %d, %zu bytes in %d "
+	       "sg buffers, %ld failed)\n", nthreads,
+	       (double)total / secs, nthreads, iterations,
+	       payload_size, sg_buffers, failures);
+	printf("            latency us: p50 %ld p99 %ld max %ld\n",
+	       latency[total / 2] / 1000, latency[total * 99 / 100] / 1000,
+	       latency[total - 1] / 1000);
+	free(latency);
+	return failures ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t max_threads] [-n iterations] "
+		"[-s payload_bytes] [-g sg_buffers] [-r rt_prio] "
+		"[-b background_procs]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int pipefd[2];
+	pid_t server, client, hogs[MAX_BACKGROUND];
+	int opt, status, n, ret = 0;
+	char ok = 0;
+
+	while ((opt = getopt(argc, argv, "t:n:s:g:r:b:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			sg_buffers = atoi(optarg);
+			break;
+		case 'r':
+			rt_prio = atoi(optarg);
+			break;
+		case 'b':
+			background = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || iterations < 1 ||
+	    sg_buffers < 0 || sg_buffers > MAX_SG_BUFFERS ||
+	    rt_prio < 0 || rt_prio > 99 || background < 0 ||
+	    background > MAX_BACKGROUND)
+		usage(argv[0]);
+
+	if (access(BINDER_DEV, R_OK | W_OK)) {
+		printf("binder_bench: %s not available, skipping\n",
+		       BINDER_DEV);
+		return 0;
+	}
+
+	if (pipe(pipefd))
+		return 1;
+	server = fork();
+	if (server == 0) {
+		close(pipefd[0]);
+		exit(run_server(pipefd[1]));
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &ok, 1) != 1 || !ok) {
+		printf("binder_bench: context manager unavailable, skipping\n");
+		waitpid(server, NULL, 0);
+		return 0;
+	}
+
+	for (n = 0; n < background; n++) {
+		hogs[n] = fork();
+		if (hogs[n] == 0)
+			for (;;)
+				;
+	}
+
+	for (n = 1; n <= max_threads; n++) {
+		client = fork();
+		if (client == 0)
+			exit(run_client(n));
+		waitpid(client, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+
+	for (n = 0; n < background; n++) {
+		kill(hogs[n], SIGKILL);
+		waitpid(hogs[n], NULL, 0);
+	}
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+	return ret;
+}
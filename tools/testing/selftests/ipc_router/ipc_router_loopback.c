@@ -0,0 +1,235 @@
+/*
+ * IPC router local loopback throughput test.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * A server socket binds a test service name and echoes every message
+ * back to its sender.  Several client processes then send numbered
+ * messages to the service by name and wait for each echo, so that all
+ * of them hit the router's server and local port lookups at the same
+ * time.  Messages between local ports never leave the router, which
+ * makes this a loopback transport that needs no remote processor.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+/* From include/linux/msm_ipc.h */
+#define AF_MSM_IPC		27
+#define MSM_IPC_ADDR_NAME	1
+#define MSM_IPC_ADDR_ID		2
+
+struct msm_ipc_port_addr {
+	uint32_t node_id;
+	uint32_t port_id;
+};
+
+struct msm_ipc_port_name {
+	uint32_t service;
+	uint32_t instance;
+};
+
+struct msm_ipc_addr {
+	unsigned char addrtype;
+	union {
+		struct msm_ipc_port_addr port_addr;
+		struct msm_ipc_port_name port_name;
+	} addr;
+};
+
+struct sockaddr_msm_ipc {
+	unsigned short family;
+	struct msm_ipc_addr address;
+	unsigned char reserved;
+};
+
+#define TEST_SERVICE	0x7e57
+#define MAX_MSG_LEN	1024
+
+struct msg_hdr {
+	uint32_t client;
+	uint32_t seq;
+};
+
+static int nr_clients = 4;
+static int nr_msgs = 2000;
+static int msg_len = 64;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void service_addr(struct sockaddr_msm_ipc *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->family = AF_MSM_IPC;
+	addr->address.addrtype = MSM_IPC_ADDR_NAME;
+	addr->address.addr.port_name.service = TEST_SERVICE;
+	addr->address.addr.port_name.instance = getpid();
+}
+
+static void run_server(int fd)
+{
+	struct sockaddr_msm_ipc from;
+	socklen_t len;
+	char buf[MAX_MSG_LEN];
+	int n;
+
+	for (;;) {
+		len = sizeof(from);
+		n = recvfrom(fd, buf, sizeof(buf), 0,
+			     (struct sockaddr *)&from, &len);
+		if (n < 0) {
+			if (errno == ETIMEDOUT || errno == EINTR)
+				continue;
+			perror("server recvfrom");
+			exit(1);
+		}
+		if (sendto(fd, buf, n, 0, (struct sockaddr *)&from,
+			   sizeof(from)) != n) {
+			perror("server sendto");
+			exit(1);
+		}
+	}
+}
+
+static int run_client(uint32_t client, const struct sockaddr_msm_ipc *srv)
+{
+	char tx[MAX_MSG_LEN], rx[MAX_MSG_LEN];
+	struct msg_hdr *hdr = (struct msg_hdr *)tx;
+	int fd, i, n;
+
+	fd = socket(AF_MSM_IPC, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("client socket");
+		return 1;
+	}
+
+	for (i = sizeof(*hdr); i < msg_len; i++)
+		tx[i] = client + i;
+	hdr->client = client;
+
+	for (hdr->seq = 0; hdr->seq < nr_msgs; hdr->seq++) {
+		if (sendto(fd, tx, msg_len, 0, (struct sockaddr *)srv,
+			   sizeof(*srv)) != msg_len) {
+			perror("client sendto");
+			return 1;
+		}
+		n = recv(fd, rx, sizeof(rx), 0);
+		if (n < 0) {
+			perror("client recv");
+			return 1;
+		}
+		if (n != msg_len || memcmp(tx, rx, msg_len)) {
+			fprintf(stderr, "client %u message %u: bad %s\n",
+				client, hdr->seq,
+				n != msg_len ? "length" : "data");
+			return 1;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_msm_ipc srv;
+	pid_t server, *clients;
+	uint64_t start, ns;
+	int fd, i, opt, status, ret = 0;
+
+	while ((opt = getopt(argc, argv, "c:n:l:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_clients = atoi(optarg);
+			break;
+		case 'n':
+			nr_msgs = atoi(optarg);
+			break;
+		case 'l':
+			msg_len = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c clients] [-n messages] "
+				"[-l message length]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_clients < 1 || nr_msgs < 1 ||
+	    msg_len < (int)sizeof(struct msg_hdr) || msg_len > MAX_MSG_LEN) {
+		fprintf(stderr, "ipc_router_loopback: bad arguments\n");
+		return 1;
+	}
+
+	fd = socket(AF_MSM_IPC, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		printf("ipc_router_loopback: AF_MSM_IPC: %s [SKIP]\n",
+		       strerror(errno));
+		return 0;
+	}
+	service_addr(&srv);
+	if (bind(fd, (struct sockaddr *)&srv, sizeof(srv))) {
+		perror("bind");
+		return 1;
+	}
+
+	server = fork();
+	if (server < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (server == 0)
+		run_server(fd);
+	close(fd);
+
+	clients = calloc(nr_clients, sizeof(*clients));
+	if (!clients) {
+		perror("calloc");
+		ret = 1;
+		goto out;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_clients; i++) {
+		clients[i] = fork();
+		if (clients[i] < 0) {
+			perror("fork");
+			ret = 1;
+			break;
+		}
+		if (clients[i] == 0)
+			exit(run_client(i, &srv));
+	}
+	while (--i >= 0) {
+		if (waitpid(clients[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+	ns = now_ns() - start;
+
+	if (!ret)
+		printf("%d clients %8.0f round trips/s %8.0f bytes/s\n",
+		       nr_clients, (double)nr_clients * nr_msgs * 1e9 / ns,
+		       2.0 * nr_clients * nr_msgs * msg_len * 1e9 / ns);
+	free(clients);
+out:
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+	printf("ipc_router_loopback: %s\n", ret ? "[FAIL]" : "[PASS]");
+	return ret;
+}
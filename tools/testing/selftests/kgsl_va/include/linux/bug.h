@@ -0,0 +1,14 @@
+#ifndef _SHIM_LINUX_BUG_H
+#define _SHIM_LINUX_BUG_H
+
+#include <stdio.h>
+
+#define WARN(cond, ...) ({				\
+	int __ret = !!(cond);				\
+	if (__ret)					\
+		fprintf(stderr, __VA_ARGS__);		\
+	__ret;						\
+})
+#define WARN_ON(cond)	WARN(cond, "WARN_ON(%s)\n", #cond)
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _SHIM_LINUX_EXPORT_H
+#define _SHIM_LINUX_EXPORT_H
+#define EXPORT_SYMBOL(sym)
+#endif
@@ -0,0 +1,2 @@
+/* Use the kernel's own rbtree, only its includes are stubbed out */
+#include "../../../../../../include/linux/rbtree.h"
@@ -0,0 +1 @@
+#include <stddef.h>
@@ -0,0 +1,433 @@
+/*
+ * kgsl_va_test: stress and replay harness for the KGSL GPU virtual
+ * address allocator (drivers/gpu/msm/kgsl_va.c), built in userspace.
+ *
+ * Without arguments it runs a synthetic workload modelled on a GPU
+ * process (lots of small buffers, some textures and render targets,
+ * random frees), checks every allocation against a shadow bitmap and
+ * the allocator's trees against their invariants, and compares it to
+ * a first-fit bitmap allocator like the gen_pool it replaced, which
+ * must not fail fewer allocations.
+ *
+ * With -t it replays a trace instead, one operation per line:
+ *	a <id> <size> [align_order]
+ *	f <id>
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../../../drivers/gpu/msm/kgsl_va.c"
+
+#define POOL_BASE	0x00010000U
+#define POOL_SIZE	0x0FFF0000U
+#define POOL_ORDER	12
+#define GRANULE		(1U << POOL_ORDER)
+#define NR_GRANULES	(POOL_SIZE / GRANULE)
+
+struct op {
+	int alloc;
+	unsigned int id;
+	unsigned int size;
+	int align;
+};
+
+struct live {
+	unsigned int addr;
+	unsigned int size;
+};
+
+static struct op *ops;
+static unsigned int nr_ops, max_id;
+
+/* -------- reference: first-fit bitmap, what gen_pool does -------- */
+
+static unsigned char bitmap[NR_GRANULES];
+
+static unsigned int bitmap_alloc(unsigned int size, int align_order)
+{
+	unsigned int n = (size + GRANULE - 1) >> POOL_ORDER;
+	unsigned int step = 1, start, i;
+
+	if (align_order > POOL_ORDER)
+		step = 1U << (align_order - POOL_ORDER);
+
+	for (start = 0; start + n <= NR_GRANULES; start += step) {
+		for (i = 0; i < n && !bitmap[start + i]; i++)
+			;
+		if (i == n) {
+			memset(bitmap + start, 1, n);
+			return POOL_BASE + (start << POOL_ORDER);
+		}
+		/* skip past the busy granule, keeping the alignment */
+		start = ((start + i) / step) * step;
+	}
+	return 0;
+}
+
+static void bitmap_free(unsigned int addr, unsigned int size)
+{
+	memset(bitmap + ((addr - POOL_BASE) >> POOL_ORDER), 0,
+	       (size + GRANULE - 1) >> POOL_ORDER);
+}
+
+/* -------- checks -------- */
+
+static unsigned char shadow[NR_GRANULES];
+static int errors;
+
+#define fail(...) do { fprintf(stderr, __VA_ARGS__); errors++; } while (0)
+
+static void shadow_set(unsigned int addr, unsigned int size, int val)
+{
+	unsigned int first = (addr - POOL_BASE) >> POOL_ORDER;
+	unsigned int n = ALIGN(size, GRANULE) >> POOL_ORDER;
+	unsigned int i;
+
+	if (addr < POOL_BASE || first + n > NR_GRANULES) {
+		fail("range 0x%08x+%u outside the pool\n", addr, size);
+		return;
+	}
+	for (i = first; i < first + n; i++) {
+		if (shadow[i] == val)
+			fail("granule %u of 0x%08x+%u already %s\n", i - first,
+			     addr, size, val ? "allocated" : "free");
+		shadow[i] = val;
+	}
+}
+
+static unsigned int check_subtree(struct rb_node *node, unsigned int *count,
+				  unsigned int *total, unsigned int *prev_end)
+{
+	struct kgsl_va_range *r;
+	unsigned int max, right;
+
+	if (node == NULL)
+		return 0;
+
+	max = check_subtree(node->rb_left, count, total, prev_end);
+	r = to_range(node);
+	if (r->size == 0)
+		fail("empty free range at 0x%08x\n", r->start);
+	if (*prev_end && r->start <= *prev_end)
+		fail("free range 0x%08x not merged or out of order\n",
+		     r->start);
+	*prev_end = r->start + r->size;
+	*count += 1;
+	*total += r->size;
+	max = max(max, r->size);
+	right = check_subtree(node->rb_right, count, total, prev_end);
+	max = max(max, right);
+	if (r->max_free != max)
+		fail("max_free of 0x%08x is %u, should be %u\n", r->start,
+		     r->max_free, max);
+	return max;
+}
+
+static void check_pool(struct kgsl_va_pool *pool)
+{
+	unsigned int count = 0, total = 0, prev_end = 0;
+
+	check_subtree(pool->free.rb_node, &count, &total, &prev_end);
+	if (count != pool->nr_free)
+		fail("nr_free %u, tree has %u ranges\n", pool->nr_free, count);
+	if (total + pool->allocated != pool->size)
+		fail("free %u + allocated %u != size %u\n", total,
+		     pool->allocated, pool->size);
+}
+
+/* -------- workload -------- */
+
+static unsigned int rnd(unsigned int n)
+{
+	return (unsigned int)(random() % n);
+}
+
+/* Size mix of a GPU process: mostly small buffers, a few big surfaces */
+static void gen_ops(unsigned int n)
+{
+	unsigned int *live_ids = calloc(n, sizeof(*live_ids));
+	unsigned int nr_live = 0, i;
+	unsigned long long live_bytes = 0;
+	unsigned int *sizes = calloc(n, sizeof(*sizes));
+
+	ops = calloc(n, sizeof(*ops));
+	for (i = 0; i < n; i++) {
+		struct op *op = &ops[nr_ops++];
+		/* keep the pool around 70% full once warmed up */
+		int do_free = nr_live &&
+			(live_bytes > POOL_SIZE / 10 * 7 || rnd(100) < 40);
+
+		if (do_free) {
+			unsigned int j = rnd(nr_live);
+
+			op->alloc = 0;
+			op->id = live_ids[j];
+			live_bytes -= sizes[op->id];
+			live_ids[j] = live_ids[--nr_live];
+			continue;
+		}
+
+		op->alloc = 1;
+		op->id = max_id++;
+		switch (rnd(20)) {
+		case 0:
+			op->size = (1 + rnd(8)) << 20;
+			break;
+		case 1: case 2: case 3: case 4:
+			op->size = (1 + rnd(16)) << 16;
+			break;
+		default:
+			op->size = (1 + rnd(16)) << 12;
+			break;
+		}
+		op->align = op->size >= (1 << 16) ? 16 : 12;
+		sizes[op->id] = op->size;
+		live_bytes += op->size;
+		live_ids[nr_live++] = op->id;
+	}
+	free(live_ids);
+	free(sizes);
+}
+
+static int load_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	unsigned int cap = 0;
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct op op = { .align = POOL_ORDER };
+		char c;
+
+		if (sscanf(line, " %c %u %u %d", &c, &op.id, &op.size,
+			   &op.align) < 2 || (c != 'a' && c != 'f'))
+			continue;
+		op.alloc = c == 'a';
+		if (op.alloc && op.size == 0)
+			continue;
+		if (nr_ops == cap) {
+			cap = cap ? cap * 2 : 4096;
+			ops = realloc(ops, cap * sizeof(*ops));
+		}
+		ops[nr_ops++] = op;
+		if (op.id >= max_id)
+			max_id = op.id + 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+/* -------- replay -------- */
+
+struct result {
+	const char *name;
+	unsigned int allocs, frees, failed;
+	unsigned long long *alloc_ns;
+	unsigned long long free_ns, max_free_ns;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(struct result *r)
+{
+	unsigned long long sum = 0;
+	unsigned int i;
+
+	qsort(r->alloc_ns, r->allocs, sizeof(*r->alloc_ns), cmp_ull);
+	for (i = 0; i < r->allocs; i++)
+		sum += r->alloc_ns[i];
+
+	printf("%-8s allocs %u (failed %u) frees %u\n", r->name, r->allocs,
+	       r->failed, r->frees);
+	if (r->allocs)
+		printf("%-8s alloc ns: mean %llu p50 %llu p99 %llu max %llu\n",
+		       r->name, sum / r->allocs, r->alloc_ns[r->allocs / 2],
+		       r->alloc_ns[r->allocs * 99 / 100],
+		       r->alloc_ns[r->allocs - 1]);
+	if (r->frees)
+		printf("%-8s free ns:  mean %llu max %llu\n", r->name,
+		       r->free_ns / r->frees, r->max_free_ns);
+}
+
+static void replay(struct result *r, struct kgsl_va_pool *pool, int check)
+{
+	struct live *live = calloc(max_id, sizeof(*live));
+	unsigned long long t;
+	unsigned int i;
+
+	r->alloc_ns = calloc(nr_ops, sizeof(*r->alloc_ns));
+
+	for (i = 0; i < nr_ops; i++) {
+		struct op *op = &ops[i];
+		struct live *l = &live[op->id];
+
+		if (op->alloc) {
+			if (l->addr)
+				continue;
+			t = now_ns();
+			if (pool)
+				l->addr = kgsl_va_pool_alloc(pool, op->size,
+							     op->align);
+			else
+				l->addr = bitmap_alloc(op->size, op->align);
+			r->alloc_ns[r->allocs++] = now_ns() - t;
+			if (l->addr == 0) {
+				r->failed++;
+				continue;
+			}
+			l->size = op->size;
+			if (check) {
+				if (l->addr & ((1U << max(op->align,
+							  POOL_ORDER)) - 1))
+					fail("0x%08x not aligned to order %d\n",
+					     l->addr, op->align);
+				shadow_set(l->addr, l->size, 1);
+			}
+		} else {
+			if (!l->addr)
+				continue;
+			if (check)
+				shadow_set(l->addr, l->size, 0);
+			t = now_ns();
+			if (pool)
+				kgsl_va_pool_free(pool, l->addr, l->size);
+			else
+				bitmap_free(l->addr, l->size);
+			t = now_ns() - t;
+			r->free_ns += t;
+			r->max_free_ns = max(r->max_free_ns, t);
+			r->frees++;
+			l->addr = 0;
+		}
+
+		if (check && pool && (i % 1024 == 0 || i == nr_ops - 1))
+			check_pool(pool);
+	}
+
+	report(r);
+
+	if (pool) {
+		struct kgsl_va_stats stats;
+
+		kgsl_va_pool_stats(pool, &stats);
+		printf("%-8s end: %u kB allocated, %u kB free in %u ranges, "
+		       "largest %u kB, fragmentation %u%%\n", r->name,
+		       stats.allocated >> 10, stats.free >> 10, stats.nr_free,
+		       stats.largest_free >> 10, stats.free ?
+		       100 - (unsigned int)((unsigned long long)
+				stats.largest_free * 100 / stats.free) : 0);
+
+		/* drain, everything must merge back into one range */
+		for (i = 0; i < max_id; i++)
+			if (live[i].addr) {
+				if (check)
+					shadow_set(live[i].addr, live[i].size,
+						   0);
+				kgsl_va_pool_free(pool, live[i].addr,
+						  live[i].size);
+			}
+		if (check) {
+			check_pool(pool);
+			if (pool->nr_free != 1 || pool->allocated)
+				fail("pool not empty after drain\n");
+		}
+	}
+
+	free(live);
+	free(r->alloc_ns);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t trace] [-n ops] [-s seed] [-q]\n"
+		"  -t  replay a trace of 'a <id> <size> [align_order]' and "
+		"'f <id>' lines\n"
+		"  -n  number of synthetic operations (default 200000)\n"
+		"  -s  random seed (default 1)\n"
+		"  -q  skip the correctness checks, for timing only\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct result va = { .name = "kgsl_va" }, ref = { .name = "bitmap" };
+	struct kgsl_va_pool *pool;
+	const char *trace = NULL;
+	unsigned int n = 200000, seed = 1;
+	int opt, check = 1;
+
+	while ((opt = getopt(argc, argv, "t:n:s:qh")) != -1) {
+		switch (opt) {
+		case 't':
+			trace = optarg;
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			check = 0;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (trace) {
+		if (load_trace(trace))
+			return 2;
+	} else {
+		srandom(seed);
+		gen_ops(n);
+	}
+	printf("%u operations, %u buffers\n", nr_ops, max_id);
+
+	pool = kgsl_va_pool_create(POOL_ORDER, POOL_BASE, POOL_SIZE);
+	if (pool == NULL)
+		return 2;
+	replay(&va, pool, check);
+	kgsl_va_pool_destroy(pool);
+
+	replay(&ref, NULL, 0);
+
+	if (va.failed > ref.failed)
+		fail("%u allocations failed, %u with first fit\n", va.failed,
+		     ref.failed);
+
+	if (errors) {
+		printf("kgsl_va_test: %d errors [FAIL]\n", errors);
+		return 1;
+	}
+	printf("kgsl_va_test: [PASS]\n");
+	return 0;
+}
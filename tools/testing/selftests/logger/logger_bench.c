@@ -0,0 +1,282 @@
+/*
+ * Android logger multi-writer throughput benchmark.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Runs 1..N threads that write liblog style entries (priority, tag and
+ * message in three iovecs) to a log as fast as they can, and reports the
+ * aggregate rate for every thread count.  A reader thread drains the log
+ * with v2 headers meanwhile and checks that every entry it gets is well
+ * formed and was written by one of the writers, which catches entries
+ * torn by concurrent writers or by the reader racing a wrap-around.
+ *
+ * With -b the reader uses batched reads and a wakeup watermark, and the
+ * number of entries it gets per read() is reported as well.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+/* From drivers/staging/android/logger.h */
+struct logger_entry {
+	uint16_t len;
+	uint16_t hdr_size;
+	int32_t pid;
+	int32_t tid;
+	int32_t sec;
+	int32_t nsec;
+	uint32_t euid;
+	char msg[0];
+};
+
+#define LOGGER_ENTRY_MAX_PAYLOAD	4076
+#define __LOGGERIO			0xAE
+#define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4)
+#define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6)
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 7)
+#define LOGGER_SET_WATERMARK		_IO(__LOGGERIO, 8)
+#define LOGGER_READ_BATCH		1
+
+struct logger_watermark {
+	uint32_t bytes;
+	uint32_t entries;
+};
+
+#define MAX_THREADS	16
+#define TAG		"logger_bench"
+
+static const char *const log_paths[] = { "/dev/log/main", "/dev/log_main" };
+static const char *dev;
+static int max_threads = 4;
+static int seconds = 2;
+static int msg_len = 64;
+static int batch;
+static volatile int stop;
+
+struct writer {
+	pthread_t thread;
+	int id;
+	uint64_t nr_writes;
+	long failures;
+};
+
+static struct {
+	pthread_t thread;
+	uint64_t nr_entries;
+	uint64_t nr_reads;
+	long bad;
+} rd;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	char prio = 4, msg[LOGGER_ENTRY_MAX_PAYLOAD];
+	struct iovec vec[3];
+	int fd;
+
+	fd = open(dev, O_WRONLY);
+	if (fd < 0) {
+		w->failures++;
+		return NULL;
+	}
+
+	/* The message says who wrote it, the reader checks it */
+	memset(msg, 'a' + w->id, msg_len - 1);
+	msg[msg_len - 1] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = TAG;
+	vec[1].iov_len = sizeof(TAG);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_len;
+
+	while (!stop) {
+		if (writev(fd, vec, 3) != (ssize_t)(1 + sizeof(TAG) + msg_len))
+			w->failures++;
+		else
+			w->nr_writes++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int check_entry(struct logger_entry *e, ssize_t n)
+{
+	const char *msg;
+	int i;
+
+	if (n < (ssize_t)sizeof(*e) || e->hdr_size != sizeof(*e) ||
+	    e->len + sizeof(*e) != (size_t)n)
+		return -1;
+
+	/* Only look at our own entries, others may be logging too */
+	if (e->len != 1 + sizeof(TAG) + msg_len ||
+	    memcmp(e->msg + 1, TAG, sizeof(TAG)))
+		return 0;
+
+	msg = e->msg + 1 + sizeof(TAG);
+	if (msg[0] < 'a' || msg[0] >= 'a' + MAX_THREADS)
+		return -1;
+	for (i = 1; i < msg_len - 1; i++)
+		if (msg[i] != msg[0])
+			return -1;
+	return msg[msg_len - 1] == '\0' ? 0 : -1;
+}
+
+static void *reader_thread(void *arg)
+{
+	static char buf[64 * 1024];
+	struct logger_watermark wmark = { .bytes = 16 * 1024 };
+	size_t len = batch ? sizeof(buf) :
+		sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD;
+	int ver = 2, mode = LOGGER_READ_BATCH;
+	struct pollfd pfd;
+	ssize_t n, off;
+
+	pfd.fd = open(dev, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0 || ioctl(pfd.fd, LOGGER_SET_VERSION, &ver) ||
+	    (batch && (ioctl(pfd.fd, LOGGER_SET_READ_MODE, &mode) ||
+		       ioctl(pfd.fd, LOGGER_SET_WATERMARK, &wmark)))) {
+		rd.bad++;
+		return NULL;
+	}
+	pfd.events = POLLIN;
+
+	while (!stop) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		while ((n = read(pfd.fd, buf, len)) > 0) {
+			rd.nr_reads++;
+			for (off = 0; off < n; rd.nr_entries++) {
+				struct logger_entry *e =
+					(struct logger_entry *)(buf + off);
+				ssize_t sz = sizeof(*e) + e->len;
+
+				if (n - off < (ssize_t)sizeof(*e) ||
+				    sz > n - off || check_entry(e, sz)) {
+					rd.bad++;
+					break;
+				}
+				off += sz;
+			}
+		}
+		if (n < 0 && errno != EAGAIN)
+			rd.bad++;
+	}
+
+	close(pfd.fd);
+	return NULL;
+}
+
+static int run(int nr_threads)
+{
+	struct writer w[MAX_THREADS];
+	uint64_t start, elapsed, total = 0;
+	long failures = 0;
+	int i;
+
+	memset(w, 0, sizeof(w));
+	memset(&rd, 0, sizeof(rd));
+	stop = 0;
+
+	if (pthread_create(&rd.thread, NULL, reader_thread, NULL))
+		return -1;
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		w[i].id = i;
+		if (pthread_create(&w[i].thread, NULL, writer_thread, &w[i]))
+			return -1;
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		total += w[i].nr_writes;
+		failures += w[i].failures;
+	}
+	elapsed = now_ns() - start;
+	pthread_join(rd.thread, NULL);
+
+	printf("%2d writers: %9.0f entries/s  %7.2f MB/s  read %llu "
+	       "(%.1f per read)  bad %ld  failed writes %ld\n", nr_threads,
+	       total * 1e9 / elapsed,
+	       total * (sizeof(struct logger_entry) + 1 + sizeof(TAG) +
+			msg_len) * 1e9 / elapsed / (1 << 20),
+	       (unsigned long long)rd.nr_entries,
+	       rd.nr_reads ? (double)rd.nr_entries / rd.nr_reads : 0.0,
+	       rd.bad, failures);
+
+	return rd.bad || failures ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:s:l:b")) != -1) {
+		switch (opt) {
+		case 'b':
+			batch = 1;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			msg_len = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b] [-t max threads] "
+				"[-s seconds] [-l message length]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || seconds < 1 ||
+	    msg_len < 2 ||
+	    1 + sizeof(TAG) + msg_len > LOGGER_ENTRY_MAX_PAYLOAD) {
+		fprintf(stderr, "logger_bench: bad arguments\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(log_paths) / sizeof(log_paths[0]); i++)
+		if (access(log_paths[i], W_OK | R_OK) == 0)
+			dev = log_paths[i];
+	if (!dev) {
+		printf("logger_bench: no log device [SKIP]\n");
+		return 0;
+	}
+
+	for (i = 1; i <= max_threads; i++)
+		if (run(i))
+			ret = 1;
+
+	printf("logger_bench: %s\n", ret ? "[FAIL]" : "[PASS]");
+	return ret;
+}
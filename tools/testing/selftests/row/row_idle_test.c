@@ -0,0 +1,308 @@
+/*
+ * ROW idling workload.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Runs sequential readers that think between their reads next to random
+ * readers that do not, all with O_DIRECT 4K reads, against a disk using
+ * the ROW scheduler.  The workload is run once with fixed idling and once
+ * with adaptive idling (rd_idle_adaptive) and the throughput of each kind
+ * of reader is reported.  Fixed idling also idles for the random readers,
+ * which gains nothing and delays everybody else.
+ *
+ * The disk is only read.  Every phase is marked in the ftrace buffer, so
+ * a blktrace of the disk taken during the run can be split per phase.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#define BLK_SZ		4096
+#define MAX_READERS	16
+#define TRACE_MARKER	"/sys/kernel/debug/tracing/trace_marker"
+
+struct reader_stats {
+	uint64_t nr_reads;
+	uint64_t lat_ns;
+};
+
+static const char *dev = "/dev/mmcblk0";
+static char sysfs_dir[256];
+static int seconds = 5;
+static int nr_seq = 2;
+static int nr_rand = 2;
+static int think_us = 1000;
+static uint64_t dev_blocks;
+static struct reader_stats *stats;
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[320];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+static int sysfs_read(const char *attr, char *buf, size_t len)
+{
+	char path[320];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+static int trace_mark(const char *msg)
+{
+	int fd = open(TRACE_MARKER, O_WRONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = write(fd, msg, strlen(msg));
+	close(fd);
+	return n < 0 ? -1 : 0;
+}
+
+static void on_alarm(int sig)
+{
+	stop = 1;
+}
+
+static void reader(int id, int sequential)
+{
+	struct reader_stats *st = &stats[id];
+	uint64_t block = (dev_blocks / MAX_READERS) * id;
+	struct timespec think = {
+		.tv_sec = think_us / 1000000,
+		.tv_nsec = (think_us % 1000000) * 1000,
+	};
+	void *buf;
+	int fd;
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0 || posix_memalign(&buf, BLK_SZ, BLK_SZ))
+		exit(1);
+
+	srandom(getpid());
+	signal(SIGALRM, on_alarm);
+	alarm(seconds);
+
+	while (!stop) {
+		uint64_t start;
+
+		if (!sequential)
+			block = ((uint64_t)random() << 16 ^ random()) %
+				dev_blocks;
+		else if (++block >= dev_blocks)
+			block = 0;
+
+		start = now_ns();
+		if (pread(fd, buf, BLK_SZ, block * BLK_SZ) != BLK_SZ)
+			exit(1);
+		st->lat_ns += now_ns() - start;
+		st->nr_reads++;
+
+		if (sequential && think_us)
+			nanosleep(&think, NULL);
+	}
+	exit(0);
+}
+
+static int run_phase(int adaptive, double *seq_mbs, double *rand_mbs)
+{
+	int i, status, failed = 0, nr = nr_seq + nr_rand;
+	uint64_t seq = 0, rnd = 0, seq_lat = 0, rnd_lat = 0;
+	char msg[64];
+
+	if (sysfs_write("queue/iosched/rd_idle_adaptive",
+			adaptive ? "1" : "0")) {
+		fprintf(stderr, "row_idle_test: no rd_idle_adaptive\n");
+		return -1;
+	}
+
+	memset(stats, 0, sizeof(*stats) * MAX_READERS);
+	snprintf(msg, sizeof(msg), "row_idle_test: adaptive=%d start\n",
+		 adaptive);
+	trace_mark(msg);
+
+	for (i = 0; i < nr; i++)
+		if (fork() == 0)
+			reader(i, i < nr_seq);
+	for (i = 0; i < nr; i++)
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			failed = 1;
+
+	snprintf(msg, sizeof(msg), "row_idle_test: adaptive=%d end\n",
+		 adaptive);
+	trace_mark(msg);
+	if (failed) {
+		fprintf(stderr, "row_idle_test: reader failed\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (i < nr_seq) {
+			seq += stats[i].nr_reads;
+			seq_lat += stats[i].lat_ns;
+		} else {
+			rnd += stats[i].nr_reads;
+			rnd_lat += stats[i].lat_ns;
+		}
+	}
+
+	*seq_mbs = (double)seq * BLK_SZ / seconds / (1 << 20);
+	*rand_mbs = (double)rnd * BLK_SZ / seconds / (1 << 20);
+	printf("%-8s seq %7.2f MB/s (lat %6llu us)  rand %7.2f MB/s "
+	       "(lat %6llu us)  total %7.2f MB/s\n",
+	       adaptive ? "adaptive" : "fixed", *seq_mbs,
+	       seq ? (unsigned long long)(seq_lat / seq / 1000) : 0ULL,
+	       *rand_mbs,
+	       rnd ? (unsigned long long)(rnd_lat / rnd / 1000) : 0ULL,
+	       *seq_mbs + *rand_mbs);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d disk] [-t seconds] [-s seq readers] "
+		"[-r random readers] [-k think usec]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char sched[256], *name, *p;
+	double fs, fr, as, ar;
+	uint64_t bytes;
+	int opt, fd, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:t:s:r:k:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			nr_seq = atoi(optarg);
+			break;
+		case 'r':
+			nr_rand = atoi(optarg);
+			break;
+		case 'k':
+			think_us = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (seconds <= 0 || nr_seq < 0 || nr_rand < 0 ||
+	    nr_seq + nr_rand == 0 || nr_seq + nr_rand > MAX_READERS)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &bytes)) {
+		printf("row_idle_test: cannot open %s: %s [SKIP]\n", dev,
+		       strerror(errno));
+		return 0;
+	}
+	close(fd);
+	dev_blocks = bytes / BLK_SZ;
+
+	name = basename(strdup(dev));
+	snprintf(sysfs_dir, sizeof(sysfs_dir), "/sys/block/%s", name);
+	if (sysfs_read("queue/scheduler", sched, sizeof(sched))) {
+		printf("row_idle_test: %s is not a disk with a scheduler "
+		       "[SKIP]\n", dev);
+		return 0;
+	}
+	if (!strstr(sched, "row")) {
+		printf("row_idle_test: no ROW scheduler [SKIP]\n");
+		return 0;
+	}
+	/* Remember the current scheduler, it is the one in brackets */
+	p = strchr(sched, '[');
+	if (p) {
+		memmove(sched, p + 1, strlen(p));
+		p = strchr(sched, ']');
+		if (p)
+			*p = '\0';
+	}
+	if (sysfs_write("queue/scheduler", "row")) {
+		printf("row_idle_test: cannot select ROW [SKIP]\n");
+		return 0;
+	}
+
+	stats = mmap(NULL, sizeof(*stats) * MAX_READERS,
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	printf("%s: %d sequential readers thinking %d us, %d random "
+	       "readers, %d s per phase\n", dev, nr_seq, think_us, nr_rand,
+	       seconds);
+
+	if (run_phase(0, &fs, &fr) || run_phase(1, &as, &ar)) {
+		ret = 1;
+	} else {
+		printf("adaptive/fixed: seq %.2fx rand %.2fx total %.2fx\n",
+		       fs ? as / fs : 0, fr ? ar / fr : 0,
+		       fs + fr ? (as + ar) / (fs + fr) : 0);
+		if (as + ar < (fs + fr) * 0.9) {
+			printf("row_idle_test: adaptive idling is slower "
+			       "[FAIL]\n");
+			ret = 1;
+		} else {
+			printf("row_idle_test: [PASS]\n");
+		}
+	}
+
+	sysfs_write("queue/iosched/rd_idle_adaptive", "1");
+	sysfs_write("queue/scheduler", sched);
+	return ret;
+}
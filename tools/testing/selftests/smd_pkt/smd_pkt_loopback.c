@@ -0,0 +1,298 @@
+/*
+ * SMD packet port loopback test.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Sends numbered packets over the loopback channel, which the modem
+ * echoes back, and checks that they all come back intact and in order.
+ * The packets are moved one per write()/read(), then in batches with
+ * SMD_PKT_IOCTL_WRITEV/READV, then received through the mmap()ed ring,
+ * and the rate of each mode is reported.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/* From include/linux/msm_smd_pkt.h */
+#define SMD_PKT_IOCTL_MAGIC		0xC2
+#define SMD_PKT_IOCTL_BLOCKING_WRITE \
+	_IOR(SMD_PKT_IOCTL_MAGIC, 0, unsigned int)
+
+struct smd_pkt_iovec {
+	void *buf;
+	uint32_t len;
+};
+
+struct smd_pkt_batch {
+	struct smd_pkt_iovec *iov;
+	uint32_t count;
+};
+
+struct smd_pkt_ring_req {
+	uint32_t nr_slots;
+	uint32_t slot_size;
+};
+
+struct smd_pkt_ring_hdr {
+	uint32_t nr_slots;
+	uint32_t slot_size;
+	uint32_t head;
+	uint32_t tail;
+};
+
+#define SMD_PKT_BATCH_MAX		64
+#define SMD_PKT_RING_HDR_SIZE		4096
+#define SMD_PKT_IOCTL_READV \
+	_IOWR(SMD_PKT_IOCTL_MAGIC, 1, struct smd_pkt_batch)
+#define SMD_PKT_IOCTL_WRITEV \
+	_IOW(SMD_PKT_IOCTL_MAGIC, 2, struct smd_pkt_batch)
+#define SMD_PKT_IOCTL_RING_SETUP \
+	_IOW(SMD_PKT_IOCTL_MAGIC, 3, struct smd_pkt_ring_req)
+#define SMD_PKT_IOCTL_RING_FILL		_IO(SMD_PKT_IOCTL_MAGIC, 4)
+
+#define DEV		"/dev/smd_pkt_loopback"
+#define BATCH		16
+#define RING_SLOTS	64
+#define RING_SLOT_SIZE	1024
+
+static int nr_packets = 4096;
+static int pkt_len = 256;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fill(char *buf, uint32_t seq)
+{
+	int i;
+
+	memcpy(buf, &seq, sizeof(seq));
+	for (i = sizeof(seq); i < pkt_len; i++)
+		buf[i] = seq + i;
+}
+
+static int check(const char *buf, int len, uint32_t seq)
+{
+	char want[pkt_len];
+
+	fill(want, seq);
+	if (len != pkt_len || memcmp(buf, want, pkt_len)) {
+		fprintf(stderr, "packet %u: bad %s\n", seq,
+			len != pkt_len ? "length" : "data");
+		return -1;
+	}
+	return 0;
+}
+
+static void report(const char *mode, uint64_t ns, long calls)
+{
+	printf("%-8s %8.0f packets/s %6.1f packets/call\n", mode,
+	       nr_packets * 1e9 / ns, 2.0 * nr_packets / calls);
+}
+
+static int run_single(int fd)
+{
+	char buf[pkt_len];
+	uint64_t start = now_ns();
+	uint32_t seq;
+	int n;
+
+	for (seq = 0; seq < nr_packets; seq++) {
+		fill(buf, seq);
+		if (write(fd, buf, pkt_len) != pkt_len) {
+			perror("write");
+			return -1;
+		}
+		n = read(fd, buf, pkt_len);
+		if (n < 0) {
+			perror("read");
+			return -1;
+		}
+		if (check(buf, n, seq))
+			return -1;
+	}
+
+	report("single", now_ns() - start, 2L * nr_packets);
+	return 0;
+}
+
+static int send_batch(int fd, char *bufs, uint32_t seq, int count)
+{
+	struct smd_pkt_iovec iov[BATCH];
+	struct smd_pkt_batch batch = { iov, count };
+	int i, n;
+
+	for (i = 0; i < count; i++) {
+		fill(bufs + i * pkt_len, seq + i);
+		iov[i].buf = bufs + i * pkt_len;
+		iov[i].len = pkt_len;
+	}
+
+	/* Blocking writes send the whole batch or fail */
+	n = ioctl(fd, SMD_PKT_IOCTL_WRITEV, &batch);
+	if (n != count) {
+		perror("SMD_PKT_IOCTL_WRITEV");
+		return -1;
+	}
+	return 0;
+}
+
+static int run_batch(int fd)
+{
+	char tx[BATCH * pkt_len], rx[BATCH * pkt_len];
+	struct smd_pkt_iovec iov[BATCH];
+	struct smd_pkt_batch batch = { iov, 0 };
+	uint64_t start = now_ns();
+	uint32_t sent, got, seq;
+	long calls = 0;
+	int i, n;
+
+	for (sent = got = 0; got < nr_packets; ) {
+		if (sent == got) {
+			n = nr_packets - sent;
+			if (n > BATCH)
+				n = BATCH;
+			if (send_batch(fd, tx, sent, n))
+				return -1;
+			sent += n;
+			calls++;
+		}
+
+		batch.count = sent - got;
+		for (i = 0; i < batch.count; i++) {
+			iov[i].buf = rx + i * pkt_len;
+			iov[i].len = pkt_len;
+		}
+		n = ioctl(fd, SMD_PKT_IOCTL_READV, &batch);
+		if (n <= 0) {
+			perror("SMD_PKT_IOCTL_READV");
+			return -1;
+		}
+		calls++;
+		for (i = 0, seq = got; i < n; i++, seq++)
+			if (check(iov[i].buf, iov[i].len, seq))
+				return -1;
+		got += n;
+	}
+
+	report("batch", now_ns() - start, calls);
+	return 0;
+}
+
+static int run_ring(int fd)
+{
+	struct smd_pkt_ring_req req = { RING_SLOTS, RING_SLOT_SIZE };
+	volatile struct smd_pkt_ring_hdr *hdr;
+	size_t size = SMD_PKT_RING_HDR_SIZE + RING_SLOTS * RING_SLOT_SIZE;
+	char tx[BATCH * pkt_len], *map, *slot;
+	uint64_t start;
+	uint32_t sent, got, head;
+	long calls = 0;
+	int n, ret = -1;
+
+	if (ioctl(fd, SMD_PKT_IOCTL_RING_SETUP, &req)) {
+		perror("SMD_PKT_IOCTL_RING_SETUP");
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	hdr = (void *)map;
+
+	start = now_ns();
+	for (sent = got = 0; got < nr_packets; ) {
+		if (sent == got) {
+			n = nr_packets - sent;
+			if (n > BATCH)
+				n = BATCH;
+			if (send_batch(fd, tx, sent, n))
+				goto out;
+			sent += n;
+			calls++;
+		}
+
+		if (ioctl(fd, SMD_PKT_IOCTL_RING_FILL) <= 0) {
+			perror("SMD_PKT_IOCTL_RING_FILL");
+			goto out;
+		}
+		calls++;
+
+		head = hdr->head;
+		__sync_synchronize();
+		while (hdr->tail != head) {
+			slot = map + SMD_PKT_RING_HDR_SIZE +
+				(hdr->tail & (RING_SLOTS - 1)) * RING_SLOT_SIZE;
+			if (check(slot + sizeof(uint32_t),
+				  *(uint32_t *)slot, got))
+				goto out;
+			got++;
+			__sync_synchronize();
+			hdr->tail++;
+		}
+	}
+
+	report("ring", now_ns() - start, calls);
+	ret = 0;
+out:
+	munmap(map, size);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int blocking = 1, fd, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_packets = atoi(optarg);
+			break;
+		case 'l':
+			pkt_len = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n packets] "
+				"[-l packet length]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_packets < 1 || pkt_len < (int)sizeof(uint32_t) ||
+	    pkt_len > RING_SLOT_SIZE - (int)sizeof(uint32_t)) {
+		fprintf(stderr, "smd_pkt_loopback: bad arguments\n");
+		return 1;
+	}
+
+	fd = open(DEV, O_RDWR);
+	if (fd < 0) {
+		printf("smd_pkt_loopback: %s: %s [SKIP]\n", DEV,
+		       strerror(errno));
+		return 0;
+	}
+	if (ioctl(fd, SMD_PKT_IOCTL_BLOCKING_WRITE, &blocking)) {
+		perror("SMD_PKT_IOCTL_BLOCKING_WRITE");
+		return 1;
+	}
+
+	if (run_single(fd) || run_batch(fd) || run_ring(fd))
+		ret = 1;
+
+	close(fd);
+	printf("smd_pkt_loopback: %s\n", ret ? "[FAIL]" : "[PASS]");
+	return ret;
+}
@@ -0,0 +1,179 @@
+/*
+ * zram swap-out throughput benchmark.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Runs 1..N writer threads against an initialized zram device.  Each
+ * thread writes compressible, non-zero pages with O_DIRECT into its own
+ * region of the device, which is the pattern swap-out produces, and the
+ * aggregate rate is reported for every thread count.  With per-CPU
+ * compression streams the rate should scale with the number of CPUs.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define ZRAM_DEV		"/dev/zram0"
+#define PAGE_SZ			4096
+#define MAX_THREADS		16
+
+static const char *dev = ZRAM_DEV;
+static int max_threads = 4;
+static int passes = 4;
+static uint64_t region_pages;
+
+struct writer {
+	pthread_t thread;
+	int id;
+	int fd;
+	long failures;
+};
+
+/*
+ * Fill a page with a pattern that LZO compresses well but that is not
+ * zero-filled: runs of a repeated word broken up by a counter.
+ */
+static void fill_page(uint8_t *buf, uint64_t seq)
+{
+	uint32_t *p = (uint32_t *)buf;
+	size_t i;
+
+	for (i = 0; i < PAGE_SZ / sizeof(*p); i++)
+		p[i] = (i & 7) ? 0x5a5a0000 | (i & 0xff) : (uint32_t)(seq + i);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	off_t base = (off_t)w->id * region_pages * PAGE_SZ;
+	uint8_t *buf;
+	uint64_t i;
+	int pass;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ)) {
+		w->failures = 1;
+		return NULL;
+	}
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < region_pages; i++) {
+			fill_page(buf, (uint64_t)pass << 32 | i);
+			if (pwrite(w->fd, buf, PAGE_SZ,
+				   base + (off_t)i * PAGE_SZ) != PAGE_SZ)
+				w->failures++;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static long elapsed_ns(const struct timespec *start,
+		       const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000L +
+		end->tv_nsec - start->tv_nsec;
+}
+
+static int run_writers(int nthreads)
+{
+	struct writer writers[MAX_THREADS];
+	struct timespec start, end;
+	long failures = 0;
+	double secs, mbytes;
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		writers[i].id = i;
+		writers[i].failures = 0;
+		writers[i].fd = open(dev, O_WRONLY | O_DIRECT);
+		if (writers[i].fd < 0) {
+			perror("open");
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&writers[i].thread, NULL, writer_thread,
+			       &writers[i]);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(writers[i].thread, NULL);
+		failures += writers[i].failures;
+		close(writers[i].fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = elapsed_ns(&start, &end) / 1e9;
+	mbytes = (double)nthreads * passes * region_pages * PAGE_SZ /
+		(1024 * 1024);
+	printf("threads %2d: %8.1f MB/s (%d x %d x %llu pages, %ld failed)\n",
+	       nthreads, mbytes / secs, nthreads, passes,
+	       (unsigned long long)region_pages, failures);
+	return failures ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-t max_threads] "
+		"[-p passes]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = 0;
+	int opt, fd, n, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:t:p:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || passes < 1)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0) {
+		printf("zram_bench: %s not available, skipping\n", dev);
+		return 0;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) < 0 || !size) {
+		printf("zram_bench: %s not initialized, skipping\n", dev);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	/* Only write half the device so we never run it out of memory. */
+	region_pages = size / 2 / PAGE_SZ / max_threads;
+	if (!region_pages) {
+		printf("zram_bench: %s too small, skipping\n", dev);
+		return 0;
+	}
+
+	for (n = 1; n <= max_threads; n++)
+		if (run_writers(n))
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,266 @@
+/*
+ * zram compression algorithm comparison.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * For every algorithm listed in comp_algorithm, resets the device,
+ * selects the algorithm and writes then reads back several kinds of
+ * page contents with O_DIRECT.  Reports the compression ratio from
+ * orig_data_size/compr_data_size and the write (compress) and read
+ * (decompress) rate for each.  The device is reset, so this refuses to
+ * run on one that is initialized unless -f is given.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#define PAGE_SZ			4096
+#define MAX_ALGS		8
+
+static const char *name = "zram0";
+static int npages = 16384;
+static int force;
+
+enum content {
+	CONTENT_TEXT,
+	CONTENT_POINTERS,
+	CONTENT_SPARSE,
+	CONTENT_RANDOM,
+	CONTENT_MIXED,
+	NR_CONTENT,
+};
+
+static const char * const content_names[NR_CONTENT] = {
+	"text", "pointers", "sparse", "random", "mixed",
+};
+
+static const char * const words[] = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+	"with", "was", "on", "be", "at", "by", "this", "had", "not", "are",
+	"android", "activity", "service", "intent", "view", "layout",
+	"string", "resource", "java", "lang", "object", "class", "method",
+};
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[128];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, strlen(val)) == (ssize_t)strlen(val) ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+static int sysfs_read(const char *attr, char *buf, size_t len)
+{
+	char path[128];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+static unsigned long long sysfs_read_ull(const char *attr)
+{
+	char buf[64];
+
+	if (sysfs_read(attr, buf, sizeof(buf)))
+		return 0;
+	return strtoull(buf, NULL, 10);
+}
+
+/* Approximations of what ends up in anonymous memory. */
+static void fill_page(uint8_t *buf, enum content type, unsigned int seq)
+{
+	uint64_t *q = (uint64_t *)buf;
+	size_t i, len;
+
+	if (type == CONTENT_MIXED)
+		type = seq % 10 < 3 ? CONTENT_TEXT :
+			seq % 10 < 7 ? CONTENT_POINTERS :
+			seq % 10 < 9 ? CONTENT_SPARSE : CONTENT_RANDOM;
+
+	switch (type) {
+	case CONTENT_TEXT:
+		for (i = 0; i < PAGE_SZ; i += len + 1) {
+			const char *w = words[rand() % (sizeof(words) /
+							sizeof(words[0]))];
+
+			len = strlen(w);
+			if (i + len + 1 > PAGE_SZ)
+				len = PAGE_SZ - i - 1;
+			memcpy(buf + i, w, len);
+			buf[i + len] = ' ';
+		}
+		break;
+	case CONTENT_POINTERS:
+		for (i = 0; i < PAGE_SZ / sizeof(*q); i++)
+			q[i] = i & 1 ? (uint64_t)(rand() % 64) :
+				0x0000007f8a000000ULL | (rand() & 0xfff8);
+		break;
+	case CONTENT_SPARSE:
+		memset(buf, 0, PAGE_SZ);
+		for (i = 0; i < 8; i++)
+			q[rand() % (PAGE_SZ / sizeof(*q))] = rand();
+		buf[0] = 1;
+		break;
+	case CONTENT_RANDOM:
+	default:
+		for (i = 0; i < PAGE_SZ / sizeof(*q); i++)
+			q[i] = (uint64_t)rand() << 32 | rand();
+		break;
+	}
+}
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run_one(const char *alg, enum content type)
+{
+	char dev[64], val[32];
+	struct timespec start, end;
+	unsigned long long orig, compr;
+	double wsecs, rsecs, mbytes;
+	uint8_t *pages, *buf;
+	int fd, i, ret = 1;
+
+	if (sysfs_write("reset", "1") || sysfs_write("comp_algorithm", alg)) {
+		fprintf(stderr, "%s: cannot select %s\n", name, alg);
+		return 1;
+	}
+	snprintf(val, sizeof(val), "%llu",
+		 (unsigned long long)npages * PAGE_SZ);
+	if (sysfs_write("disksize", val)) {
+		fprintf(stderr, "%s: cannot set disksize\n", name);
+		return 1;
+	}
+
+	if (posix_memalign((void **)&pages, PAGE_SZ,
+			   (size_t)npages * PAGE_SZ) ||
+	    posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ))
+		return 1;
+	srand(type + 1);
+	for (i = 0; i < npages; i++)
+		fill_page(pages + (size_t)i * PAGE_SZ, type, i);
+
+	snprintf(dev, sizeof(dev), "/dev/%s", name);
+	fd = open(dev, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < npages; i++)
+		if (pwrite(fd, pages + (size_t)i * PAGE_SZ, PAGE_SZ,
+			   (off_t)i * PAGE_SZ) != PAGE_SZ)
+			goto out_close;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wsecs = elapsed(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < npages; i++)
+		if (pread(fd, buf, PAGE_SZ, (off_t)i * PAGE_SZ) != PAGE_SZ)
+			goto out_close;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rsecs = elapsed(&start, &end);
+
+	/* Spot check that the data survived the round trip. */
+	if (memcmp(buf, pages + (size_t)(npages - 1) * PAGE_SZ, PAGE_SZ)) {
+		fprintf(stderr, "%s: %s data mismatch\n", alg,
+			content_names[type]);
+		goto out_close;
+	}
+
+	orig = sysfs_read_ull("orig_data_size");
+	compr = sysfs_read_ull("compr_data_size");
+	mbytes = (double)npages * PAGE_SZ / (1024 * 1024);
+	printf("%-8s %-9s ratio %5.2f  write %8.1f MB/s  read %8.1f MB/s\n",
+	       alg, content_names[type], compr ? (double)orig / compr : 0.0,
+	       mbytes / wsecs, mbytes / rsecs);
+	ret = 0;
+
+out_close:
+	close(fd);
+out:
+	free(pages);
+	free(buf);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d zram_name] [-n pages] [-f]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char buf[256], *algs[MAX_ALGS], *tok, *save;
+	int opt, nalgs = 0, i, t, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:f")) != -1) {
+		switch (opt) {
+		case 'd':
+			name = optarg;
+			break;
+		case 'n':
+			npages = atoi(optarg);
+			break;
+		case 'f':
+			force = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (npages < 1)
+		usage(argv[0]);
+
+	if (sysfs_read("comp_algorithm", buf, sizeof(buf))) {
+		printf("zram_comp_bench: %s has no comp_algorithm, skipping\n",
+		       name);
+		return 0;
+	}
+	if (sysfs_read_ull("initstate") && !force) {
+		printf("zram_comp_bench: %s is in use, skipping "
+		       "(-f resets it anyway)\n", name);
+		return 0;
+	}
+
+	for (tok = strtok_r(buf, " []\n", &save); tok && nalgs < MAX_ALGS;
+	     tok = strtok_r(NULL, " []\n", &save))
+		algs[nalgs++] = tok;
+
+	for (i = 0; i < nalgs; i++)
+		for (t = 0; t < NR_CONTENT; t++)
+			if (run_one(algs[i], t))
+				ret = 1;
+
+	sysfs_write("reset", "1");
+	return ret;
+}